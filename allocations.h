@@ -0,0 +1,39 @@
+// ==========================================================================
+// Heap allocation counter
+//
+// A program built with COUNT_ALLOCATIONS replaces the global operator new
+// and delete with ones that count every allocation, so a frame can be
+// checked for allocating by reading the count before and after it. Without
+// it the count stays 0 and nothing is replaced. The replacements are
+// definitions: only one translation unit of a program may include this with
+// COUNT_ALLOCATIONS defined, which every program here, being one unit, can.
+// ==========================================================================
+
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+inline std::atomic<unsigned long long> &allocationCounter() {
+  static std::atomic<unsigned long long> count(0);
+  return count;
+}
+
+// Heap allocations made so far, by every thread.
+inline unsigned long long allocationCount() { return allocationCounter().load(std::memory_order_relaxed); }
+
+#ifdef COUNT_ALLOCATIONS
+// Out of line, so the compiler does not pair an inlined free() with
+// operator new. Array new and delete come here through the defaults.
+__attribute__((noinline)) void *operator new(size_t size) {
+  allocationCounter().fetch_add(1, std::memory_order_relaxed);
+  if (void *p = malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { free(p); }
+#endif
+
+#endif
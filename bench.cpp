@@ -0,0 +1,1531 @@
+// ==========================================================================
+// bench: throughput benchmarks for the text pipeline
+//
+// Usage:  bench [directory]      (default: cmuntt/)
+//         bench -json out.json [directory]
+//         bench -compare baseline.json [-threshold percent] [directory]
+//
+// -json runs the regression suite, each pipeline stage on fixed corpora,
+// and writes ns/op, items/s and allocations/op ("-" for stdout). -compare
+// runs it against a stored -json file and exits with 1 if any stage got
+// slower than the threshold (default 10%) or allocates more. Without
+// either, bench exits with 1 if the 16-bit glyph format strays more than
+// 0.25 px from the outlines at the maximum zoom or takes a glyph too large
+// for it, if a filled glyph's or a self-crossing zigzag's triangles or the
+// software rasterizer's fills disagree with the winding number of the
+// outlines, if a hit test disagrees with a linear scan of the glyphs, if a
+// label batch loses characters or uploads more than a moved label's slot, or
+// if a steady-state frame allocates on the heap.
+// ==========================================================================
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bezier.h"
+#include "bvh.h"
+#include "document.h"
+#include "fill.h"
+#include "glbackend.h"
+#include "glyphgeometry.h"
+#include "glyphs.h"
+#include "labels.h"
+#include "loader.h"
+#include "profiler.h"
+#include "raster.h"
+#include "utf8.h"
+
+// Every allocation in the program, for allocations/op and the frame checks
+#define COUNT_ALLOCATIONS
+#include "allocations.h"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The token-by-token fscanf reader Loader::load used before OutlineParser,
+// kept as the baseline.
+bool readOutlineScanf(const string &path, Outline &outline) {
+  outline.commands.clear();
+  outline.coords.clear();
+
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == NULL) return false;
+
+  char lineType[8];
+  while (fscanf(file, "%7s", lineType) != EOF) {
+    int pairs = 0;
+    if (strcmp(lineType, "M") == 0 || strcmp(lineType, "L") == 0) pairs = 1;
+    else if (strcmp(lineType, "C") == 0) pairs = 3;
+    else if (strcmp(lineType, "Z") != 0) continue;
+
+    float c[6];
+    for (int i = 0; i < pairs * 2; i++) fscanf(file, "%f", &c[i]);
+
+    outline.commands.push_back(lineType[0]);
+    outline.coords.insert(outline.coords.end(), c, c + pairs * 2);
+  }
+
+  fclose(file);
+  return true;
+}
+
+void report(const char *name, double seconds, int rounds, size_t glyphs, size_t bytes) {
+  double perRound = seconds / rounds;
+  printf("  %-22s %9.3f ms  %8.1f MB/s  %10.0f glyphs/s\n", name, perRound * 1e3,
+         bytes / perRound / 1e6, glyphs / perRound);
+}
+
+void benchParsing(const string &directory) {
+  vector<int> codes = listGlyphCodes(directory);
+  vector<string> paths;
+  vector<vector<char> > files;
+  size_t bytes = 0;
+  for (int code : codes) {
+    paths.push_back(directory + "gly_" + std::to_string(code));
+    FILE *file = fopen(paths.back().c_str(), "rb");
+    vector<char> contents;
+    char chunk[4096];
+    size_t n;
+    while (file && (n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+      contents.insert(contents.end(), chunk, chunk + n);
+    if (file) fclose(file);
+    bytes += contents.size();
+    files.push_back(contents);
+  }
+
+  // Both parsers must agree exactly before their speeds mean anything.
+  Outline expected, actual;
+  OutlineParser parser;
+  size_t mismatches = 0;
+  for (const string &path : paths) {
+    readOutlineScanf(path, expected);
+    parser.read(path, actual);
+    if (expected.commands != actual.commands || expected.coords != actual.coords) mismatches++;
+  }
+
+  printf("parse: %zu glyphs, %.2f MB, %zu mismatches against fscanf\n",
+         codes.size(), bytes / 1e6, mismatches);
+
+  const int rounds = 5;
+  Clock::time_point start = Clock::now();
+  for (int r = 0; r < rounds; r++)
+    for (const string &path : paths) readOutlineScanf(path, expected);
+  report("fscanf (files)", secondsSince(start), rounds, codes.size(), bytes);
+
+  start = Clock::now();
+  for (int r = 0; r < rounds; r++)
+    for (const string &path : paths) parser.read(path, actual);
+  report("OutlineParser (files)", secondsSince(start), rounds, codes.size(), bytes);
+
+  start = Clock::now();
+  for (int r = 0; r < rounds * 4; r++)
+    for (const vector<char> &file : files)
+      parseOutline(file.data(), file.data() + file.size(), actual);
+  report("parseOutline (memory)", secondsSince(start), rounds * 4, codes.size(), bytes);
+}
+
+void reportFrame(const char *name, const RecordingBackend &recorder, double seconds, int frames) {
+  const GLStats &frame = recorder.frame;
+  printf("  %-28s %7.3f ms  %3llu calls  %llu/%llu buffers created/deleted  %6llu B uploaded  %6llu B copied\n",
+         name, seconds / frames * 1e3, frame.calls, frame.buffersCreated, frame.buffersDeleted,
+         frame.bytesUploaded, frame.bytesCopied);
+}
+
+// Drives the frame loop against RecordingBackend and reports the GL traffic
+// of the last frame of each scenario and any objects still alive afterwards.
+void benchFrames() {
+  RecordingBackend recorder;
+  setGLBackend(&recorder);
+
+  const int frames = 1000;
+  printf("frames: %d frames per scenario, CPU time and GL traffic per frame\n", frames);
+  {
+    Program program("vertex.glsl", "tessControl.glsl", "tessEvaluation.glsl", "fragment.glsl");
+    GlyphCache glyphs;
+    LayoutEngine layouts(glyphs);
+    Loader pangram("The quick brown fox jumps over the lazy dog", layouts);
+    Loader other("Sphinx of black quartz, judge my vow", layouts);
+    Loader *loaders[] = { &pangram, &other };
+
+    VertexArray va = pangram.load();
+    float transform[16] = {};
+
+    // A steady-state frame is what render() issues: the transform uniforms
+    // and one draw of the prebuilt patches.
+    Clock::time_point start = Clock::now();
+    for (int f = 0; f < frames; f++) {
+      recorder.beginFrame();
+      recorder.useProgram(program.id);
+      recorder.uniformMatrix4fv(recorder.getUniformLocation(program.id, "S"), 1, GL_FALSE, transform);
+      recorder.uniformMatrix4fv(recorder.getUniformLocation(program.id, "T"), 1, GL_FALSE, transform);
+      recorder.bindVertexArray(va.id);
+      recorder.drawArrays(GL_PATCHES, 0, va.count);
+    }
+    reportFrame("steady state", recorder, secondsSince(start), frames);
+
+    // Text changing every frame, into a fresh vertex array each time...
+    start = Clock::now();
+    for (int f = 0; f < frames; f++) {
+      recorder.beginFrame();
+      VertexArray fresh = loaders[f % 2]->load();
+      recorder.drawArrays(GL_PATCHES, 0, fresh.count);
+    }
+    reportFrame("text change, new array", recorder, secondsSince(start), frames);
+
+    // ...and rewritten in place in the persistent one.
+    start = Clock::now();
+    for (int f = 0; f < frames; f++) {
+      recorder.beginFrame();
+      loaders[f % 2]->load(va);
+      recorder.drawArrays(GL_PATCHES, 0, va.count);
+    }
+    reportFrame("text change, in place", recorder, secondsSince(start), frames);
+  }
+  printf("  objects alive after shutdown: %zu\n", recorder.liveObjects());
+  setGLBackend(0);
+}
+
+// Every printable ASCII glyph, repeated, as one patch stream.
+vector<float> asciiPatches(GlyphCache &glyphs, int copies) {
+  string text;
+  for (int i = 0; i < copies; i++)
+    for (char c = 33; c < 127; c++) text += c;
+  vector<float> patches;
+  LayoutEngine layouts(glyphs);
+  Loader(text, layouts).build(patches);
+  return patches;
+}
+
+void benchBezier() {
+  GlyphCache glyphs;
+  vector<float> patches = asciiPatches(glyphs, 20);
+  size_t count = patches.size() / PATCH_FLOATS;
+  BezierBasis basis(SHADER_SEGMENTS);
+  Flattener flattener;
+  const float tolerance = 0.001f;   // glyph units; ~0.4 px at the default zoom
+
+  const char *names[] = { "scalar", "sse", "avx2" };
+  vector<BezierKernel> kernels;
+  kernels.push_back(BEZIER_SCALAR);
+#ifdef BEZIER_X86
+  kernels.push_back(BEZIER_SSE);
+  if (__builtin_cpu_supports("avx2")) kernels.push_back(BEZIER_AVX2);
+#endif
+
+  printf("bezier: %zu patches, %d segments fixed or %g tolerance adaptive\n",
+         count, SHADER_SEGMENTS, tolerance);
+
+  vector<float> out;
+  for (BezierKernel kernel : kernels) {
+    // Agreement with the shader's formula, evaluated point by point
+    out.clear();
+    evaluatePatches(patches.data(), count, basis, out, kernel);
+    double error = 0.0;
+    for (size_t p = 0; p < count; p++) {
+      for (int i = 0; i <= SHADER_SEGMENTS; i++) {
+        float x, y;
+        bezierPoint(&patches[p * PATCH_FLOATS], (float)i / SHADER_SEGMENTS, x, y);
+        const float *v = &out[(p * (SHADER_SEGMENTS + 1) + i) * 2];
+        error = std::max(error, (double)std::max(std::fabs(v[0] - x), std::fabs(v[1] - y)));
+      }
+    }
+
+    const int rounds = 50;
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < rounds; r++) {
+      out.clear();
+      evaluatePatches(patches.data(), count, basis, out, kernel);
+    }
+    double fixed = secondsSince(start) / rounds;
+
+    vector<int> counts;
+    start = Clock::now();
+    for (int r = 0; r < rounds; r++) {
+      out.clear();
+      counts.clear();
+      flattener.flatten(patches.data(), count, tolerance, out, counts, kernel);
+    }
+    double adaptive = secondsSince(start) / rounds;
+
+    printf("  %-6s  fixed %7.2f Mpatches/s  adaptive %7.2f Mpatches/s (%zu vertices vs %zu)  max error %.2g\n",
+           names[kernel], count / fixed / 1e6, count / adaptive / 1e6,
+           out.size() / 2, count * (SHADER_SEGMENTS + 1), error);
+  }
+}
+
+// Vertices the tessellator emits for the pangram with the per-patch levels
+// of tessControl.glsl, against the old fixed level of 16.
+void benchTessellationLevels() {
+  GlyphCache glyphs;
+  LayoutEngine layouts(glyphs);
+  string text = "The quick brown fox jumps over the lazy dog";
+  vector<float> patches;
+  Loader(text, layouts).build(patches);
+  size_t count = patches.size() / PATCH_FLOATS;
+
+  printf("tessellation: %zu pangram patches at 768x768, 0.25 px tolerance, max level 64\n", count);
+  float zooms[] = { 1.0f, 10.0f, 100.0f };
+  for (float zoom : zooms) {
+    float scale = 3.0f * zoom / text.length();
+    size_t vertices = 0, single = 0;
+    for (size_t p = 0; p < count; p++) {
+      int level = screenSegments(&patches[p * PATCH_FLOATS], scale, 0.0f, 768, 768, 0.25f, 64);
+      vertices += level + 1;
+      if (level == 1) single++;
+    }
+    printf("  zoom %5gx: %7zu vertices (fixed 16: %zu), %zu patches at level 1\n",
+           zoom, vertices, count * (SHADER_SEGMENTS + 1), single);
+  }
+}
+
+// About 1 MB of UTF-8 cycling through Latin, accented Latin, Greek and
+// Cyrillic words, with a few CJK and emoji code points the font lacks.
+string mixedScriptDocument(size_t bytes) {
+  const int words[][8] = {
+    { 'q', 'u', 'i', 'c', 'k' },
+    { 0xFC, 'b', 'e', 'r', 0xE9 },
+    { 0x3B1, 0x3BB, 0x3C6, 0x3B1 },
+    { 0x43F, 0x440, 0x438, 0x432, 0x435, 0x442 },
+    { 'f', 'o', 'x' },
+    { 0x4E2D, 0x6587 },
+    { 0x3A9, 0x3BC, 0x3AD, 0x3B3, 0x3B1 },
+    { 0x1F600 },
+  };
+  string text;
+  for (size_t w = 0; text.size() < bytes; w++) {
+    for (int c : words[w % 8]) {
+      if (c) appendUTF8(c, text);
+    }
+    text += ' ';
+  }
+  return text;
+}
+
+void benchUnicode(const string &directory) {
+  string text = mixedScriptDocument(1 << 20);
+  vector<int> codes;
+  decodeUTF8(text, codes);
+
+  vector<int> available = listGlyphCodes(directory);
+  GlyphTable table;
+  std::unordered_map<int, int> map;
+  for (size_t i = 0; i < available.size(); i++) {
+    table.insert(available[i], i);
+    map[available[i]] = i;
+  }
+
+  printf("unicode: %.2f MB of mixed-script UTF-8, %zu code points, %zu glyphs in %zu table pages\n",
+         text.size() / 1e6, codes.size(), available.size(), table.pageCount());
+
+  const int rounds = 10;
+  Clock::time_point start = Clock::now();
+  for (int r = 0; r < rounds; r++) decodeUTF8(text, codes);
+  double seconds = secondsSince(start) / rounds;
+  printf("  %-22s %9.3f ms  %8.1f MB/s\n", "decode", seconds * 1e3, text.size() / seconds / 1e6);
+
+  long long sum = 0;
+  start = Clock::now();
+  for (int r = 0; r < rounds; r++)
+    for (int c : codes) sum += table.find(c);
+  seconds = secondsSince(start) / rounds;
+  printf("  %-22s %9.3f ms  %8.2f ns/lookup\n", "GlyphTable", seconds * 1e3, seconds / codes.size() * 1e9);
+
+  start = Clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (int c : codes) {
+      auto found = map.find(c);
+      sum += found != map.end() ? found->second : -1;
+    }
+  }
+  seconds = secondsSince(start) / rounds;
+  printf("  %-22s %9.3f ms  %8.2f ns/lookup\n", "unordered_map", seconds * 1e3, seconds / codes.size() * 1e9);
+
+  // Layout: decoding, metrics and line breaking for the whole document,
+  // unwrapped and wrapped to 80 columns, then served from the layout cache
+  GlyphCache glyphs(directory);
+  LayoutEngine layouts(glyphs);
+  float columns80 = 80 * layouts.spaceAdvance;
+  float wraps[] = { 0.0f, columns80 };
+  for (float wrap : wraps) {
+    unsigned long fallbacks = glyphs.fallbacks;
+    start = Clock::now();
+    for (int r = 0; r < rounds; r++) {
+      layouts.clear();
+      layouts.layout(text, wrap);
+    }
+    seconds = secondsSince(start) / rounds;
+    const TextLayout &layout = layouts.layout(text, wrap);
+    printf("  %-22s %9.3f ms  %8.2f ns/code point  %6d lines  (%lu fallbacks per pass)\n",
+           wrap ? "layout, 80 columns" : "layout, unwrapped", seconds * 1e3,
+           seconds / codes.size() * 1e9, layout.lines, (glyphs.fallbacks - fallbacks) / rounds);
+  }
+  start = Clock::now();
+  for (int r = 0; r < rounds; r++) layouts.layout(text, columns80);
+  seconds = secondsSince(start) / rounds;
+  printf("  %-22s %9.3f ms\n", "layout, cached", seconds * 1e3);
+  LayoutHandle handle;
+  layouts.layout(text, columns80, handle);
+  start = Clock::now();
+  for (int r = 0; r < rounds; r++) layouts.layout(text, columns80, handle);
+  seconds = secondsSince(start) / rounds;
+  printf("  %-22s %9.3f ms\n", "layout, by handle", seconds * 1e3);
+  if (sum == 42) printf("\n");   // keeps the lookups from being optimized away
+}
+
+void reportUpload(const char *name, const RecordingBackend &recorder, double seconds) {
+  const GLStats &frame = recorder.frame;
+  printf("  %-28s %8.3f ms  %8llu B uploaded  %4llu draws  %7llu vertices\n", name, seconds * 1e3,
+         frame.bytesUploaded, frame.drawCalls, frame.verticesDrawn);
+}
+
+// sentence repeated to n characters.
+string prose(const string &sentence, size_t n) {
+  string text;
+  while (text.size() < n) text += sentence + " ";
+  return text.substr(0, n);
+}
+
+// GL traffic of putting a 10k-character string on screen and then changing
+// it: the whole patch stream uploaded into one array versus glyphs uploaded
+// once and drawn from per-character instances.
+void benchInstancing(const string &directory) {
+  RecordingBackend recorder;
+  setGLBackend(&recorder);
+  {
+    GlyphCache glyphs(directory);
+    LayoutEngine layouts(glyphs);
+    float wrap = 100 * layouts.spaceAdvance;
+    Loader first(prose("The quick brown fox jumps over the lazy dog.", 10000), layouts, wrap);
+    Loader second(prose("Sphinx of black quartz, judge my vow!", 10000), layouts, wrap);
+    printf("instancing: %zu glyphs drawn, GL traffic per step\n", first.layout().glyphs.size());
+
+    recorder.beginFrame();
+    Clock::time_point start = Clock::now();
+    VertexArray va = first.load();
+    recorder.bindVertexArray(va.id);
+    recorder.drawArrays(GL_PATCHES, 0, va.count);
+    reportUpload("patches, first text", recorder, secondsSince(start));
+
+    recorder.beginFrame();
+    start = Clock::now();
+    second.load(va);
+    recorder.bindVertexArray(va.id);
+    recorder.drawArrays(GL_PATCHES, 0, va.count);
+    reportUpload("patches, text change", recorder, secondsSince(start));
+
+    GlyphGeometry geometry(glyphs);
+    recorder.beginFrame();
+    start = Clock::now();
+    geometry.setText(first.layout());
+    geometry.draw();
+    reportUpload("instances, first text", recorder, secondsSince(start));
+
+    recorder.beginFrame();
+    start = Clock::now();
+    geometry.setText(second.layout());
+    geometry.draw();
+    reportUpload("instances, text change", recorder, secondsSince(start));
+
+    recorder.beginFrame();
+    start = Clock::now();
+    geometry.setText(first.layout());
+    geometry.draw();
+    reportUpload("instances, back again", recorder, secondsSince(start));
+    printf("  %zu glyphs in the shared buffer, %zu B\n", geometry.glyphCount(), geometry.geometryBytes());
+  }
+  setGLBackend(0);
+}
+
+// Wall time to read and measure every glyph from the text files: serially
+// on this thread, then with preloadAsync() on 1 to 8 workers.
+void benchPreload(const string &directory) {
+  vector<int> codes = listGlyphCodes(directory);
+  const int rounds = 3;
+  double serial = 1e9;
+  for (int r = 0; r < rounds; r++) {
+    Clock::time_point start = Clock::now();
+    GlyphCache glyphs(directory, "");
+    for (int code : codes) glyphs.get(code);
+    serial = std::min(serial, secondsSince(start));
+  }
+  printf("preload: %zu glyphs from %s, %u cores\n", codes.size(), directory.c_str(),
+         std::thread::hardware_concurrency());
+  printf("  serial      %7.2f ms\n", serial * 1e3);
+
+  for (unsigned workers = 1; workers <= 8; workers *= 2) {
+    ThreadPool pool(workers + 1);
+    double best = 1e9;
+    for (int r = 0; r < rounds; r++) {
+      Clock::time_point start = Clock::now();
+      GlyphCache glyphs(directory, "");
+      glyphs.preloadAsync(pool, true);
+      glyphs.waitForPreload();
+      best = std::min(best, secondsSince(start));
+    }
+    printf("  %u worker%s  %7.2f ms  (%.2fx)\n", workers, workers > 1 ? "s" : " ", best * 1e3, serial / best);
+  }
+}
+
+// Control points of the straight cubic from a to b, as tessControl.glsl
+// expands a line.
+void linePatch(float ax, float ay, float bx, float by, float *patch) {
+  for (int i = 0; i < 4; i++) {
+    patch[i * 2] = ax + (bx - ax) * i / 3.0f;
+    patch[i * 2 + 1] = ay + (by - ay) * i / 3.0f;
+  }
+}
+
+// Every glyph of the font in GlyphGeometry's 16-bit format against its
+// float outline: memory, and the farthest the drawn curves move, in pixels
+// at MAX_GLYPH_PIXELS. Returns false unless that stays under the 0.25 px
+// tessellation tolerance.
+bool benchQuantization(const string &directory) {
+  GlyphCache glyphs(directory);
+  vector<int> codes = listGlyphCodes(directory);
+  vector<float> floats;
+  vector<int16_t> cubics, lines;
+  size_t floatBytes = 0, compactBytes = 0, cubicCount = 0, lineCount = 0;
+  double error = 0.0;
+  const int samples = 32;
+
+  for (int code : codes) {
+    OutlineView outline = glyphs.get(code);
+    floats.clear();
+    cubics.clear();
+    lines.clear();
+    Loader::appendPatches(outline, 0.0f, 0.0f, floats);
+    appendCompactPatches(outline, cubics, lines);
+    floatBytes += floats.size() * sizeof(float);
+    compactBytes += (cubics.size() + lines.size()) * sizeof(int16_t);
+    cubicCount += cubics.size() / 8;
+    lineCount += lines.size() / 4;
+
+    // Walk the outline and the compact segments side by side
+    const float *c = outline.coords;
+    const int16_t *cubic = cubics.data(), *line = lines.data();
+    float start[2] = {}, pen[2] = {};
+    for (size_t i = 0; i < outline.commandCount; i++) {
+      float expected[8], actual[8];
+      char command = outline.commands[i];
+      if (command == 'M') {
+        start[0] = pen[0] = c[0];
+        start[1] = pen[1] = c[1];
+        c += 2;
+        continue;
+      } else if (command == 'C') {
+        float patch[8] = { pen[0], pen[1], c[0], c[1], c[2], c[3], c[4], c[5] };
+        std::copy(patch, patch + 8, expected);
+        for (int k = 0; k < 8; k++) actual[k] = dequantizeCoord(*cubic++);
+        pen[0] = c[4];
+        pen[1] = c[5];
+        c += 6;
+      } else {
+        const float *end = command == 'L' ? c : start;
+        linePatch(pen[0], pen[1], end[0], end[1], expected);
+        bool kept = quantizeCoord(pen[0]) != quantizeCoord(end[0]) ||
+                    quantizeCoord(pen[1]) != quantizeCoord(end[1]);
+        if (command == 'L' || kept) {
+          linePatch(dequantizeCoord(line[0]), dequantizeCoord(line[1]),
+                    dequantizeCoord(line[2]), dequantizeCoord(line[3]), actual);
+          line += 4;
+        } else {
+          // A dropped closing line: the outline ends where it started
+          float at[2] = { dequantizeCoord(quantizeCoord(end[0])), dequantizeCoord(quantizeCoord(end[1])) };
+          linePatch(at[0], at[1], at[0], at[1], actual);
+        }
+        pen[0] = end[0];
+        pen[1] = end[1];
+        if (command == 'L') c += 2;
+      }
+      for (int k = 0; k <= samples; k++) {
+        float ex, ey, ax, ay;
+        bezierPoint(expected, (float)k / samples, ex, ey);
+        bezierPoint(actual, (float)k / samples, ax, ay);
+        error = std::max(error, (double)std::hypot(ax - ex, ay - ey));
+      }
+    }
+  }
+
+  double pixels = error * MAX_GLYPH_PIXELS;
+  bool within = pixels < 0.25;
+  printf("quantization: %zu glyphs, %zu cubics and %zu lines\n", codes.size(), cubicCount, lineCount);
+  printf("  float patches %8zu B  compact %8zu B (%.0f%%)\n", floatBytes, compactBytes,
+         100.0 * compactBytes / floatBytes);
+  printf("  max error %.2g glyph units, %.3f px at %g px per unit: %s\n", error, pixels,
+         MAX_GLYPH_PIXELS, within ? "within 0.25 px" : "OVER 0.25 px");
+
+  // A glyph reaching past the range is refused rather than drawn clamped
+  static const char wideCommands[] = { 'M', 'L', 'L', 'Z' };
+  static const float wideCoords[] = { 0.0f, 0.0f, 3.0f, 0.0f, 0.0f, 1.0f };
+  EmbeddedGlyph wideGlyph = { 'W', 0, 4, 0, 6, GlyphMetrics() };
+  EmbeddedFont wide = { &wideGlyph, 1, wideCommands, wideCoords };
+  RecordingBackend recorder;
+  setGLBackend(&recorder);
+  bool refused;
+  {
+    GlyphCache cache(wide);
+    LayoutEngine layouts(cache);
+    GlyphGeometry geometry(cache);
+    geometry.setText(layouts.layout("W"));
+    refused = geometry.refused == 1 && geometry.drawCount() == 0;
+  }
+  setGLBackend(0);
+  printf("  a glyph 3 units wide is %s\n", refused ? "refused" : "NOT refused");
+  return within && refused;
+}
+
+// Whether (x, y) lies in any of the triangles, edges included.
+bool insideTriangles(const vector<float> &triangles, float x, float y) {
+  for (size_t k = 0; k + 6 <= triangles.size(); k += 6) {
+    const float *t = &triangles[k];
+    float d0 = (t[2] - t[0]) * (y - t[1]) - (t[3] - t[1]) * (x - t[0]);
+    float d1 = (t[4] - t[2]) * (y - t[3]) - (t[5] - t[3]) * (x - t[2]);
+    float d2 = (t[0] - t[4]) * (y - t[5]) - (t[1] - t[5]) * (x - t[4]);
+    if ((d0 >= 0 && d1 >= 0 && d2 >= 0) || (d0 <= 0 && d1 <= 0 && d2 <= 0)) return true;
+  }
+  return false;
+}
+
+// Every glyph's fill triangulation against the non-zero winding of its
+// flattened outline on a grid over the glyph, and the same for a zigzag of
+// strokes crossing each other many times inside one band, then what a frame
+// of the pangram costs filled against tessellated: vertices through the
+// pipeline at three zooms and draw calls. Returns false on any
+// disagreement.
+bool benchFill(const string &directory) {
+  GlyphCache glyphs(directory);
+  vector<int> codes = listGlyphCodes(directory);
+  vector<FillEdge> edges;
+  vector<float> triangles;
+  vector<int16_t> cubics, lines;
+  size_t triangleCount = 0, outlineBytes = 0, points = 0, wrong = 0;
+  double seconds = 0.0;
+  const int grid = 32;
+
+  // Counts the grid points over bbox where triangles and the winding of
+  // edges disagree
+  auto checkGrid = [&](const char *name, int code, const float *bbox) {
+    for (int i = 0; i < grid; i++) {
+      for (int j = 0; j < grid; j++) {
+        // Off the grid lines, where outline vertices tend to sit
+        float x = bbox[0] + (bbox[2] - bbox[0]) * (i + 0.37f) / grid;
+        float y = bbox[1] + (bbox[3] - bbox[1]) * (j + 0.61f) / grid;
+        bool expected = windingNumber(edges, x, y) != 0;
+        points++;
+        if (insideTriangles(triangles, x, y) != expected) {
+          if (wrong++ < 5)
+            printf("  %s %d: (%g, %g) should be %s\n", name, code, x, y, expected ? "filled" : "empty");
+        }
+      }
+    }
+  };
+
+  for (int code : codes) {
+    OutlineView outline = glyphs.get(code);
+    edges.clear();
+    triangles.clear();
+    outlineEdges(outline, FILL_TOLERANCE, edges);
+    Clock::time_point start = Clock::now();
+    FillTriangulator().triangulate(edges, triangles);
+    seconds += secondsSince(start);
+    triangleCount += triangles.size() / 6;
+    cubics.clear();
+    lines.clear();
+    appendCompactPatches(outline, cubics, lines);
+    outlineBytes += (cubics.size() + lines.size()) * sizeof(int16_t);
+
+    checkGrid("glyph", code, glyphs.metrics(code).bbox);
+  }
+  printf("fill: %zu glyphs, %zu triangles in %.1f ms, %zu B against %zu B of outline\n", codes.size(),
+         triangleCount, seconds * 1e3, triangleCount * 6 * sizeof(int16_t), outlineBytes);
+
+  // Strokes from evenly spaced feet at y = 0 to scattered heads at y = 1,
+  // so the only band is [0, 1] and every crossing lies inside it
+  const int strokes = 48;
+  vector<char> zigzag(1, 'M');
+  vector<float> coords;
+  unsigned seed = 7;
+  for (int i = 0; i < strokes; i++) {
+    seed = seed * 1103515245 + 12345;
+    float stroke[4] = { (float)i, 0.0f, (float)((seed >> 16) % 1000) * strokes / 1000.0f, 1.0f };
+    coords.insert(coords.end(), stroke, stroke + 4);
+    zigzag.push_back('L');
+    zigzag.push_back('L');
+  }
+  zigzag.back() = 'Z';
+  OutlineView outline;
+  outline.commands = zigzag.data();
+  outline.commandCount = zigzag.size();
+  outline.coords = coords.data();
+  outline.coordCount = coords.size();
+  edges.clear();
+  triangles.clear();
+  outlineEdges(outline, FILL_TOLERANCE, edges);
+  FillTriangulator().triangulate(edges, triangles);
+  size_t crossings = 0;
+  for (size_t a = 0; a < edges.size(); a++)
+    for (size_t b = a + 1; b < edges.size(); b++)
+      if ((edges[a].xAt(0.0f) - edges[b].xAt(0.0f)) * (edges[a].xAt(1.0f) - edges[b].xAt(1.0f)) < 0) crossings++;
+  float zigzagBox[4] = { 0.0f, 0.0f, (float)strokes, 1.0f };
+  checkGrid("zigzag of", strokes, zigzagBox);
+  printf("  zigzag: %d strokes, %zu crossings in one band, %zu triangles\n", strokes, crossings,
+         triangles.size() / 6);
+  printf("  %zu of %zu points disagree with the winding number\n", wrong, points);
+
+  // The pangram, as render() draws it at 768x768
+  RecordingBackend recorder;
+  setGLBackend(&recorder);
+  {
+    LayoutEngine layouts(glyphs);
+    string text = "The quick brown fox jumps over the lazy dog";
+    const TextLayout &layout = layouts.layout(text);
+    vector<float> patches;
+    Loader(text, layouts).build(patches);
+    size_t filledVertices = 0;
+    for (const GlyphPlacement &p : layout.glyphs) {
+      triangles.clear();
+      triangulateOutline(glyphs.get(p.code), triangles);
+      filledVertices += triangles.size() / 2;
+    }
+    GlyphGeometry outlines(glyphs), filled(glyphs, true);
+    outlines.setText(layout);
+    filled.setText(layout);
+    printf("  pangram: %zu draws tessellated, %zu filled; %zu vertices filled at any zoom\n",
+           outlines.drawCount(), filled.drawCount(), filledVertices);
+    float zooms[] = { 1.0f, 10.0f, 100.0f };
+    for (float zoom : zooms) {
+      float scale = 3.0f * zoom / text.length();
+      size_t vertices = 0;
+      for (size_t p = 0; p < patches.size() / PATCH_FLOATS; p++)
+        vertices += screenSegments(&patches[p * PATCH_FLOATS], scale, 0.0f, 768, 768, 0.25f, 64) + 1;
+      printf("  zoom %5gx: %7zu tessellated vertices\n", zoom, vertices);
+    }
+  }
+  setGLBackend(0);
+  return wrong == 0;
+}
+
+// A log file of about the given size: numbered lines of 2 to 20 words.
+string logDocument(size_t bytes) {
+  const char *words[] = { "GET", "/index.html", "served", "in", "12ms", "cache", "miss", "for", "user",
+                          "warning:", "retrying", "request", "after", "timeout", "ok", "error" };
+  string text;
+  char number[16];
+  unsigned seed = 1;
+  for (int line = 0; text.size() < bytes; line++) {
+    snprintf(number, sizeof(number), "%08d", line);
+    text += number;
+    seed = seed * 1103515245 + 12345;
+    for (unsigned w = 0, n = 2 + (seed >> 16) % 19; w < n; w++) {
+      text += ' ';
+      text += words[(seed >> (w % 12)) % 16];
+    }
+    text += '\n';
+  }
+  return text;
+}
+
+// The software rasterizer's fills of a few strings against the non-zero
+// winding of their patches, flattened finely, at every pixel centre more
+// than a pixel from an edge. Returns false on any disagreement.
+bool benchRasterFill(const string &directory) {
+  GlyphCache glyphs(directory);
+  LayoutEngine layouts(glyphs);
+  ThreadPool pool(2);
+  SoftwareRasterizer rasterizer(768, 768);
+  rasterizer.fill = true;
+  Image image;
+  const char *texts[] = { "The quick brown fox jumps over the lazy dog", "abc defgh ijklmnop",
+                          "Sphinx of black quartz, judge my vow!", "0123456789 (){}[]<> @#$%&*",
+                          "WAVY wavy ~~~ ,;:.!? MW iljt" };
+  size_t disagreements = 0, checked = 0, frames = 0;
+  vector<FillEdge> edges;
+  vector<std::pair<float, int> > crossings;
+  vector<unsigned char> nearEdge;
+  for (const char *text : texts) {
+    Loader loader(text, layouts);
+    vector<float> patches;
+    loader.build(patches);
+    // headless's zoom, then zoomed in for strokes many pixels wide and
+    // panned along the text
+    vector<std::pair<float, float> > views(1, std::make_pair(3.0f / loader.textLength(), 0.0f));
+    for (float pan = 0.0f; pan < loader.layout().width; pan += 3.0f) views.push_back(std::make_pair(0.5f, pan));
+    for (const std::pair<float, float> &view : views) {
+      float scale = view.first, pan = view.second;
+      rasterizer.render(patches, scale, -pan, pool, image);
+      frames++;
+
+      // The same projection as render(), 32 segments a patch
+      edges.clear();
+      for (size_t p = 0; p < patches.size(); p += PATCH_FLOATS) {
+        float projected[PATCH_FLOATS];
+        for (int i = 0; i < PATCH_FLOATS; i += 2) {
+          projected[i] = scale * (patches[p + i] - pan) * 0.5f * image.width;
+          projected[i + 1] = (0.5f - scale * patches[p + i + 1] * 0.5f) * image.height;
+        }
+        float x = projected[0], y = projected[1];
+        for (int k = 1; k <= 32; k++) {
+          FillEdge e = { x, y, 0.0f, 0.0f };
+          bezierPoint(projected, k / 32.0f, e.x1, e.y1);
+          edges.push_back(e);
+          x = e.x1;
+          y = e.y1;
+        }
+      }
+      nearEdge.assign(image.width * image.height, 0);
+      for (const FillEdge &e : edges) {
+        int x0 = std::max(0, (int)std::floor(std::min(e.x0, e.x1) - 1.5f));
+        int x1 = std::min(image.width - 1, (int)std::ceil(std::max(e.x0, e.x1) + 1.5f));
+        int y0 = std::max(0, (int)std::floor(std::min(e.y0, e.y1) - 1.5f));
+        int y1 = std::min(image.height - 1, (int)std::ceil(std::max(e.y0, e.y1) + 1.5f));
+        for (int y = y0; y <= y1; y++)
+          for (int x = x0; x <= x1; x++) nearEdge[y * image.width + x] = 1;
+      }
+
+      // The winding along each row of pixel centres, from its crossings
+      for (int y = 0; y < image.height; y++) {
+        float cy = y + 0.5f;
+        crossings.clear();
+        for (const FillEdge &e : edges)
+          if ((e.y0 <= cy) != (e.y1 <= cy)) crossings.push_back(std::make_pair(e.xAt(cy), e.y1 > e.y0 ? 1 : -1));
+        std::sort(crossings.begin(), crossings.end());
+        size_t next = 0;
+        int winding = 0;
+        for (int x = 0; x < image.width; x++) {
+          float cx = x + 0.5f;
+          for (; next < crossings.size() && crossings[next].first < cx; next++) winding += crossings[next].second;
+          if (nearEdge[y * image.width + x]) continue;
+          // Coverage back from the blend of white over render()'s grey
+          float coverage = (image.rgba[4 * (y * image.width + x)] / 255.0f - 0.2f) / 0.8f;
+          if ((winding != 0) != (coverage > 0.5f)) disagreements++;
+          checked++;
+        }
+      }
+    }
+  }
+  printf("raster fill: %zu strings in %zu frames, %zu of %zu pixel centres disagree with the winding number\n",
+         sizeof(texts) / sizeof(texts[0]), frames, disagreements, checked);
+  return disagreements == 0;
+}
+
+// Opens a log file on disk and scrolls through it at boilerplate's document
+// zoom: line by line, then jumping around. Per frame cost and memory should
+// not depend on the document's size.
+void benchDocument(const string &directory) {
+  RecordingBackend recorder;
+  setGLBackend(&recorder);
+  printf("document: boilerplate -file, per frame averages\n");
+  size_t sizes[] = { 5 << 20, 50 << 20 };
+  for (size_t bytes : sizes) {
+    const char *path = "bench-document.txt";
+    {
+      string text = logDocument(bytes);
+      FILE *file = fopen(path, "wb");
+      if (!file) break;
+      fwrite(text.data(), 1, text.size(), file);
+      fclose(file);
+    }
+
+    GlyphCache glyphs(directory);
+    LayoutEngine layouts(glyphs);
+    Document document(layouts);
+    GlyphGeometry geometry(glyphs);
+    TextLayout visible;
+
+    Clock::time_point start = Clock::now();
+    document.open(path);
+    double open = secondsSince(start);
+    remove(path);
+
+    float scale = 3.0f / 80;
+    auto frame = [&](float line) {
+      recorder.beginFrame();
+      float scroll = line * layouts.lineHeight;
+      float view[4] = { 0.0f, -1.0f / scale - scroll, 2.0f / scale, 1.0f / scale - scroll };
+      if (document.visible(view, visible)) geometry.setText(visible);
+      geometry.draw();
+    };
+
+    printf("  %.1f MB, %d lines, %zu chunks, opened in %.1f ms\n",
+           document.size() / 1e6, document.lines(), document.chunkCount(), open * 1e3);
+    const int frames = 2000;
+    float middle = document.lines() / 2;
+    const char *names[] = { "scrolling", "jumping" };
+    for (int scenario = 0; scenario < 2; scenario++) {
+      unsigned long long uploaded = 0, draws = 0;
+      size_t peak = 0;
+      unsigned seed = 7;
+      start = Clock::now();
+      for (int f = 0; f < frames; f++) {
+        if (scenario == 0) {
+          frame(middle + f * 0.25f);
+        } else {
+          seed = seed * 1103515245 + 12345;
+          frame((seed >> 8) % document.lines());
+        }
+        uploaded += recorder.frame.bytesUploaded;
+        draws += recorder.frame.drawCalls;
+        peak = std::max(peak, document.memory());
+      }
+      double seconds = secondsSince(start);
+      printf("    %-10s %8.3f ms  %8llu B uploaded  %3llu draws  %4zu chunks visible  %6.1f KB laid out (peak)\n",
+             names[scenario], seconds / frames * 1e3, uploaded / frames, draws / frames,
+             document.visibleChunks().size(), peak / 1024.0);
+    }
+    printf("    %lu chunks laid out, %lu dropped\n", document.builds, document.evictions);
+  }
+  setGLBackend(0);
+}
+
+// Patches of a glyph in glyph space, kept for the linear scans below.
+const vector<float> &scanPatches(GlyphCache &glyphs, int code) {
+  static std::unordered_map<int, vector<float> > patches;
+  auto found = patches.find(code);
+  if (found == patches.end()) {
+    found = patches.insert(std::make_pair(code, vector<float>())).first;
+    Loader::appendPatches(glyphs.get(code), 0.0f, 0.0f, found->second);
+  }
+  return found->second;
+}
+
+// Nearest patch hull of placement p to (x, y), by brute force.
+float scanDistance(GlyphCache &glyphs, const GlyphPlacement &p, float x, float y) {
+  const vector<float> &patches = scanPatches(glyphs, p.code);
+  float best = INFINITY;
+  for (size_t i = 0; i < patches.size(); i += PATCH_FLOATS)
+    best = std::min(best, hullDistance(&patches[i], x - p.x, y - p.y));
+  return best;
+}
+
+// Box of placement p's control points; false if it has no outline.
+bool scanBounds(GlyphCache &glyphs, const GlyphPlacement &p, float box[4]) {
+  const vector<float> &patches = scanPatches(glyphs, p.code);
+  box[0] = box[1] = INFINITY;
+  box[2] = box[3] = -INFINITY;
+  for (size_t i = 0; i < patches.size(); i += 2) {
+    box[0] = std::min(box[0], patches[i] + p.x);
+    box[1] = std::min(box[1], patches[i + 1] + p.y);
+    box[2] = std::max(box[2], patches[i] + p.x);
+    box[3] = std::max(box[3], patches[i + 1] + p.y);
+  }
+  return !patches.empty();
+}
+
+// GlyphBVH over a ~500k glyph log file: build, point and rectangle query
+// latency, and updates after edits, each checked against a linear scan.
+// Returns false if any query disagrees with the scan.
+bool benchHitTesting(const string &directory) {
+  GlyphCache glyphs(directory);
+  LayoutEngine layouts(glyphs);
+  string text = logDocument(580000);
+  TextLayout layout = layouts.layout(text);
+  size_t n = layout.glyphs.size();
+
+  GlyphBVH bvh(glyphs);
+  Clock::time_point start = Clock::now();
+  bvh.update(layout);
+  double build = secondsSince(start);
+  printf("hit testing: %zu glyphs on %d lines, built in %.1f ms, %zu blocks, %.1f MB\n", n, layout.lines,
+         build * 1e3, bvh.blockCount(), bvh.memory() / 1e6);
+
+  float height = layout.lines * layouts.lineHeight;
+  unsigned seed = 11;
+  auto random = [&seed](float lo, float hi) {
+    seed = seed * 1103515245 + 12345;
+    return lo + (hi - lo) * ((seed >> 8) & 0xffff) / 65535.0f;
+  };
+
+  // Point queries within a tenth of a glyph unit, a few pixels at the
+  // document zoom
+  const float radius = 0.1f;
+  const int picks = 100000;
+  size_t hits = 0;
+  start = Clock::now();
+  for (int i = 0; i < picks; i++) hits += bvh.pick(random(0.0f, layout.width), random(-height, 1.0f), radius) >= 0;
+  double pickTime = secondsSince(start) / picks;
+
+  // A screenful at boilerplate's document zoom, and about a word
+  float sizes[2][2] = { { 80.0f * layouts.spaceAdvance, 2.0f / (3.0f / 80) }, { 4.0f, 1.0f } };
+  const char *names[] = { "screen", "word" };
+  double selectTime[2];
+  size_t selected[2] = {};
+  vector<size_t> out;
+  for (int k = 0; k < 2; k++) {
+    const int queries = k == 0 ? 2000 : 100000;
+    start = Clock::now();
+    for (int i = 0; i < queries; i++) {
+      float x = random(0.0f, layout.width), y = random(-height, 1.0f);
+      float box[4] = { x, y, x + sizes[k][0], y + sizes[k][1] };
+      bvh.select(box, out);
+      selected[k] += out.size();
+    }
+    selectTime[k] = secondsSince(start) / queries;
+    selected[k] /= queries;
+  }
+  printf("  pick %7.2f us (%.0f%% hit)  select %s %7.2f us (%zu glyphs)  %s %7.2f us (%zu glyphs)\n",
+         pickTime * 1e6, 100.0 * hits / picks, names[0], selectTime[0] * 1e6, selected[0], names[1],
+         selectTime[1] * 1e6, selected[1]);
+
+  // The same queries by linear scan, over the document or within area
+  size_t wrong = 0;
+  double scanTime = 0.0;
+  auto check = [&](const TextLayout &l, int queries, const float *area) {
+    for (int i = 0; i < queries; i++) {
+      float x = area ? random(area[0], area[2]) : random(0.0f, l.width);
+      float y = area ? random(area[1], area[3]) : random(-height, 1.0f);
+      long picked = bvh.pick(x, y, radius);
+      Clock::time_point scan = Clock::now();
+      float nearest = radius;
+      bool any = false;
+      for (const GlyphPlacement &p : l.glyphs) {
+        float glyph[4];
+        if (!scanBounds(glyphs, p, glyph) || x < glyph[0] - radius || x > glyph[2] + radius ||
+            y < glyph[1] - radius || y > glyph[3] + radius)
+          continue;
+        float d = scanDistance(glyphs, p, x, y);
+        if (d <= nearest) {
+          nearest = d;
+          any = true;
+        }
+      }
+      scanTime += secondsSince(scan);
+      float found = picked >= 0 ? scanDistance(glyphs, l.glyphs[picked], x, y) : INFINITY;
+      if (any != (picked >= 0) || (any && found != nearest)) wrong++;
+
+      float box[4] = { x, y, x + 4.0f, y + 1.0f };
+      bvh.select(box, out);
+      size_t expected = 0;
+      for (size_t g = 0; g < l.glyphs.size(); g++) {
+        float glyph[4];
+        if (!scanBounds(glyphs, l.glyphs[g], glyph)) continue;
+        if (glyph[0] <= box[2] && glyph[2] >= box[0] && glyph[1] <= box[3] && glyph[3] >= box[1]) {
+          if (expected >= out.size() || out[expected] != g) wrong++;
+          expected++;
+        }
+      }
+      if (expected != out.size()) wrong++;
+    }
+  };
+  check(layout, 50, 0);
+  printf("  linear scan %7.2f ms per pick\n", scanTime / 50 * 1e3);
+
+  // Edits: a character replaced and one inserted mid-line, and a line
+  // broken in two, which moves everything after it
+  size_t middle = text.find(' ', text.size() / 2);
+  string edits[3] = { text, text, text };
+  edits[0][middle - 1] = edits[0][middle - 1] == 'x' ? 'y' : 'x';
+  edits[1].insert(middle, "x");
+  edits[2][middle] = '\n';
+  const char *editNames[] = { "replace", "insert", "new line" };
+  for (int e = 0; e < 3; e++) {
+    TextLayout edited = layouts.layout(edits[e]);
+    unsigned long before = bvh.blocksBuilt;
+    start = Clock::now();
+    bvh.update(edited);
+    double seconds = secondsSince(start);
+    printf("  update after %-8s %7.2f ms, %lu blocks rebuilt\n", editNames[e], seconds * 1e3,
+           bvh.blocksBuilt - before);
+
+    // Around the edit, and anywhere
+    size_t g = 0;
+    while (g + 1 < edited.glyphs.size() && edited.glyphs[g].code == layout.glyphs[g].code &&
+           edited.glyphs[g].x == layout.glyphs[g].x && edited.glyphs[g].y == layout.glyphs[g].y)
+      g++;
+    float area[4] = { edited.glyphs[g].x - 8.0f, edited.glyphs[g].y - 4.0f, edited.glyphs[g].x + 8.0f,
+                      edited.glyphs[g].y + 4.0f };
+    check(edited, 10, area);
+    check(edited, 3, 0);
+  }
+  printf("  %zu queries disagree with the linear scan\n", wrong);
+  return wrong == 0;
+}
+
+// 10k dashboard labels, each its own transform and colour: a LabelBatch
+// against one GlyphGeometry per label, with the GL traffic of changing one
+// label. Returns false if the batch loses or duplicates a character, or a
+// moved label uploads more than its slot.
+bool benchLabels(const string &directory) {
+  RecordingBackend recorder;
+  setGLBackend(&recorder);
+  bool ok = true;
+  {
+    GlyphCache glyphs(directory);
+    LayoutEngine layouts(glyphs);
+    const char *names[] = { "cpu", "memory", "disk", "queue", "latency", "errors", "requests", "temperature" };
+    const int count = 10000;
+    vector<string> texts(count);
+    vector<float> positions(3 * count);
+    unsigned seed = 7;
+    auto random = [&seed](int n) {
+      seed = seed * 1103515245 + 12345;
+      return (int)((seed >> 8) % n);
+    };
+    for (int i = 0; i < count; i++) {
+      texts[i] = string(names[random(8)]) + " " + std::to_string(random(1000)) + "." + std::to_string(random(10));
+      positions[3 * i] = random(2000) * 0.5f;
+      positions[3 * i + 1] = -random(2000) * 0.5f;
+      positions[3 * i + 2] = 0.25f + random(4) * 0.25f;
+    }
+    float colour[4] = { 0.9f, 0.6f, 0.2f, 1.0f };
+
+    // Characters with an outline, the instances a label draws
+    auto outlined = [&](const string &text) {
+      size_t n = 0;
+      for (const GlyphPlacement &p : layouts.layout(text).glyphs) n += glyphs.get(p.code).commandCount > 0;
+      return n;
+    };
+    size_t total = 0;
+    for (const string &text : texts) total += outlined(text);
+
+    printf("labels: %d labels, %zu characters, GL traffic per frame\n", count, total);
+    LabelBatch batch(layouts);
+    recorder.beginFrame();
+    Clock::time_point start = Clock::now();
+    vector<uint32_t> slots(count);
+    for (int i = 0; i < count; i++)
+      slots[i] = batch.add(texts[i], positions[3 * i], positions[3 * i + 1], positions[3 * i + 2], colour);
+    batch.draw();
+    reportUpload("batch, first frame", recorder, secondsSince(start));
+
+    const int frames = 100;
+    start = Clock::now();
+    for (int f = 0; f < frames; f++) {
+      recorder.beginFrame();
+      batch.draw();
+    }
+    reportUpload("batch, steady frame", recorder, secondsSince(start) / frames);
+
+    recorder.beginFrame();
+    start = Clock::now();
+    batch.move(slots[count / 2], 10.0f, -10.0f, 2.0f);
+    batch.draw();
+    reportUpload("batch, one label moved", recorder, secondsSince(start));
+    if (recorder.frame.bytesUploaded != 8 * sizeof(float)) ok = false;
+
+    recorder.beginFrame();
+    start = Clock::now();
+    batch.setText(slots[count / 3], "latency 999.9");
+    batch.draw();
+    reportUpload("batch, one text changed", recorder, secondsSince(start));
+
+    recorder.beginFrame();
+    start = Clock::now();
+    batch.remove(slots[count / 4]);
+    slots[count / 4] = batch.add("queue 1.0", 0.0f, 0.0f, 1.0f, colour);
+    batch.draw();
+    reportUpload("batch, one removed, one added", recorder, secondsSince(start));
+
+    recorder.beginFrame();
+    start = Clock::now();
+    for (int i = 0; i < count; i++) batch.move(slots[i], positions[3 * i] + 1.0f, positions[3 * i + 1], 1.0f);
+    batch.draw();
+    reportUpload("batch, every label moved", recorder, secondsSince(start));
+
+    // Every label removed but the first 100, then all back as they were
+    for (int i = 100; i < count; i++) batch.remove(slots[i]);
+    for (int i = 100; i < count; i++)
+      slots[i] = batch.add(texts[i], positions[3 * i], positions[3 * i + 1], positions[3 * i + 2], colour);
+    batch.draw();
+    size_t drawn = batch.instanceCount();
+    if (drawn != total) ok = false;
+    printf("  %zu of %zu characters drawn after the churn\n", drawn, total);
+
+    // The same labels through one GlyphGeometry each, the API before labels
+    vector<std::unique_ptr<GlyphGeometry> > separate;
+    for (int i = 0; i < count; i++) {
+      separate.emplace_back(new GlyphGeometry(glyphs));
+      separate.back()->setText(layouts.layout(texts[i]), positions[3 * i + 2]);
+    }
+    start = Clock::now();
+    for (int f = 0; f < 10; f++) {
+      recorder.beginFrame();
+      for (auto &geometry : separate) geometry->draw();
+    }
+    reportUpload("per label geometry, frame", recorder, secondsSince(start) / 10);
+  }
+  setGLBackend(0);
+  return ok;
+}
+
+// Cost of a profiled phase, CPU only and with a GPU query against
+// RecordingBackend, and of reading percentiles from a full ring.
+void benchProfiler() {
+  RecordingBackend recorder;
+  setGLBackend(&recorder);
+  {
+    const int phases = 1 << 20;
+    printf("profiler: %d phases\n", phases);
+    bool modes[] = { false, true };
+    for (bool gpu : modes) {
+      Profiler profiler(gpu);
+      Clock::time_point start = Clock::now();
+      for (int i = 0; i < phases; i++) {
+        if (i % PHASE_COUNT == 0) profiler.beginFrame();
+        ScopedPhase phase(profiler, (ProfilePhase)(i % PHASE_COUNT), true);
+      }
+      printf("  %-22s %8.1f ns/phase\n", gpu ? "cpu and gpu timers" : "cpu timer", secondsSince(start) / phases * 1e9);
+
+      float p50, p99;
+      start = Clock::now();
+      for (int phase = 0; phase < PHASE_COUNT; phase++) profiler.percentiles((ProfilePhase)phase, false, p50, p99);
+      printf("  %-22s %8.3f ms for every phase\n", "percentiles", secondsSince(start) * 1e3);
+    }
+  }
+  printf("  objects alive after shutdown: %zu\n", recorder.liveObjects());
+  setGLBackend(0);
+}
+
+// Heap allocations of steady-state frames, once the frame path has warmed
+// up: the document scrolling under the view, with its hit testing index, a
+// label batch drawn over it and a HUD of profiler percentiles laid out and
+// drawn every frame, all against RecordingBackend. Returns false if any of
+// them allocates.
+bool benchSteadyFrames(const string &directory) {
+  RecordingBackend recorder;
+  setGLBackend(&recorder);
+  bool ok = true;
+  {
+    Program program("vertex.glsl", "tessControl.glsl", "tessEvaluation.glsl", "fragment.glsl");
+    GlyphCache glyphs(directory);
+    LayoutEngine layouts(glyphs);
+    Document document(layouts);
+    document.setText(logDocument(1 << 20));
+    GlyphGeometry geometry(glyphs), hud(glyphs);
+    GlyphBVH hits(glyphs);
+    LabelBatch labels(layouts);
+    Profiler profiler(true);
+    TextLayout visible, hudLayout;
+    string hudText;
+
+    const int count = 200;
+    float colour[4] = { 0.4f, 0.9f, 0.4f, 1.0f };
+    vector<uint32_t> slots;
+    for (int i = 0; i < count; i++) slots.push_back(labels.add("label " + std::to_string(i), i, -i, 1.0f, colour));
+    const char *texts[] = { "latency 12.5", "latency 99.0" };
+
+    float scale = 3.0f / 80;
+    // The HUD's text, as boilerplate builds it
+    auto summary = [&](bool widest) {
+      hudText = "         cpu p50    p99";
+      char text[64];
+      for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        float p50 = 1234.56f, p99 = 7890.98f;
+        if (!widest && !profiler.percentiles((ProfilePhase)phase, false, p50, p99)) p50 = p99 = 0.0f;
+        snprintf(text, sizeof(text), "\n%-8s %7.2f %6.2f", PHASE_NAMES[phase], p50, p99);
+        hudText += text;
+      }
+      layouts.layout(hudText, 0.0f, hudLayout);
+    };
+    // Sized once for the most glyphs it can show, as the digits of the
+    // timings come and go
+    summary(true);
+    hud.setText(hudLayout);
+
+    auto frame = [&](float line) {
+      recorder.beginFrame();
+      profiler.beginFrame();
+      {
+        ScopedPhase phase(profiler, PHASE_LAYOUT);
+        float scroll = line * layouts.lineHeight;
+        float view[4] = { 0.0f, -1.0f / scale - scroll, 2.0f / scale, 1.0f / scale - scroll };
+        if (document.visible(view, visible)) {
+          geometry.setText(visible);
+          hits.update(visible);
+        }
+      }
+      {
+        ScopedPhase phase(profiler, PHASE_DRAW, true);
+        float transform[16] = {};
+        recorder.useProgram(program.id);
+        recorder.uniformMatrix4fv(recorder.getUniformLocation(program.id, "S"), 1, GL_FALSE, transform);
+        recorder.uniformMatrix4fv(recorder.getUniformLocation(program.id, "T"), 1, GL_FALSE, transform);
+        geometry.draw();
+        labels.draw();
+        hud.setText(hudLayout);
+        hud.draw();
+      }
+      summary(false);
+    };
+
+    const int frames = 1000;
+    float middle = document.lines() / 2;
+    const char *names[] = { "redraw", "scrolling", "labels moving", "label text changing" };
+    auto run = [&](int scenario, int f) {
+      float line = middle;
+      if (scenario == 1) line += (f < frames / 2 ? f : frames - f) * 0.25f;
+      if (scenario == 2) labels.move(slots[f % count], f % 97, -(f % 89), 1.0f);
+      if (scenario == 3) labels.setText(slots[f % count], texts[f % 2]);
+      frame(line);
+    };
+    printf("steady frames: %d frames per scenario after as many to warm up, CPU time and heap allocations\n", frames);
+    for (int scenario = 0; scenario < 4; scenario++) {
+      for (int f = 0; f < frames; f++) run(scenario, f);
+      unsigned long long allocated = allocationCount();
+      Clock::time_point start = Clock::now();
+      for (int f = 0; f < frames; f++) run(scenario, f);
+      double seconds = secondsSince(start);
+      allocated = allocationCount() - allocated;
+      if (allocated) ok = false;
+      printf("  %-20s %7.3f ms  %llu allocations in all\n", names[scenario], seconds / frames * 1e3, allocated);
+    }
+  }
+  setGLBackend(0);
+  return ok;
+}
+
+// --------------------------------------------------------------------------
+// Regression suite
+
+struct Measurement {
+  string name;
+  double nsPerOp;
+  double itemsPerSecond;
+  double allocationsPerOp;
+  size_t items;           // per op
+  unsigned long iterations;
+};
+
+// Runs op, one pass over a corpus of items, in 5 samples of at least
+// 0.05 s after one untimed pass to warm the caches, and keeps the fastest
+// sample: noise only ever adds time.
+template <typename Op>
+Measurement measure(const string &name, size_t items, Op op) {
+  op();
+  unsigned long iterations = 0;
+  unsigned long long allocated = allocationCount();
+  double best = INFINITY;
+  for (int sample = 0; sample < 5; sample++) {
+    unsigned long n = 0;
+    Clock::time_point start = Clock::now();
+    double seconds;
+    do {
+      op();
+      n++;
+    } while ((seconds = secondsSince(start)) < 0.05);
+    best = std::min(best, seconds / n);
+    iterations += n;
+  }
+
+  Measurement m;
+  m.name = name;
+  m.nsPerOp = best * 1e9;
+  m.itemsPerSecond = items / best;
+  m.allocationsPerOp = (double)(allocationCount() - allocated) / iterations;
+  m.items = items;
+  m.iterations = iterations;
+  fprintf(stderr, "  %-20s %14.0f ns/op  %12.0f items/s  %9.1f allocs/op\n",
+          name.c_str(), m.nsPerOp, m.itemsPerSecond, m.allocationsPerOp);
+  return m;
+}
+
+// Each stage of the pipeline on the pangram, every glyph of the font and a
+// synthetic log file: parsing glyph files, layout, patch generation and
+// CPU flattening.
+vector<Measurement> runSuite(const string &directory) {
+  vector<Measurement> results;
+  GlyphCache glyphs(directory);
+  LayoutEngine layouts(glyphs);
+
+  vector<int> codes = listGlyphCodes(directory);
+  string everyGlyph;
+  for (int code : codes) appendUTF8(code, everyGlyph);
+  struct Corpus {
+    const char *name;
+    string text;
+  } corpora[] = {
+    { "pangram", "The quick brown fox jumps over the lazy dog" },
+    { "glyphs", everyGlyph },
+    { "document", logDocument(64 << 10) },
+  };
+
+  // Glyph files of each corpus, read once so only parsing is timed
+  for (const Corpus &corpus : corpora) {
+    vector<int> used;
+    decodeUTF8(corpus.text, used);
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+    vector<vector<char> > files;
+    for (int code : used) {
+      std::ifstream file(directory + "gly_" + std::to_string(code), std::ios::binary);
+      if (!file) continue;
+      std::ostringstream contents;
+      contents << file.rdbuf();
+      string bytes = contents.str();
+      files.push_back(vector<char>(bytes.begin(), bytes.end()));
+    }
+    Outline outline;
+    results.push_back(measure(string("parse/") + corpus.name, files.size(), [&] {
+      for (const vector<char> &file : files) parseOutline(file.data(), file.data() + file.size(), outline);
+    }));
+  }
+
+  for (const Corpus &corpus : corpora) {
+    size_t count = layouts.layout(corpus.text).glyphs.size();
+    results.push_back(measure(string("layout/") + corpus.name, count, [&] {
+      layouts.clear();
+      layouts.layout(corpus.text);
+    }));
+  }
+
+  for (const Corpus &corpus : corpora) {
+    Loader loader(corpus.text, layouts);
+    vector<float> patches;
+    loader.build(patches);
+    results.push_back(measure(string("patches/") + corpus.name, patches.size() / PATCH_FLOATS, [&] {
+      loader.build(patches);
+    }));
+  }
+
+  Flattener flattener;
+  for (const Corpus &corpus : corpora) {
+    vector<float> patches, points;
+    vector<int> counts;
+    Loader(corpus.text, layouts).build(patches);
+    size_t count = patches.size() / PATCH_FLOATS;
+    results.push_back(measure(string("flatten/") + corpus.name, count, [&] {
+      points.clear();
+      counts.clear();
+      flattener.flatten(patches.data(), count, 0.001f, points, counts);
+    }));
+  }
+  return results;
+}
+
+bool writeJSON(const vector<Measurement> &results, const string &path) {
+  std::ostringstream json;
+  json.precision(17);
+  json << "{\n  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const Measurement &m = results[i];
+    json << "    { \"name\": \"" << m.name << "\", \"ns_per_op\": " << m.nsPerOp
+         << ", \"items_per_second\": " << m.itemsPerSecond
+         << ", \"allocations_per_op\": " << m.allocationsPerOp
+         << ", \"items\": " << m.items << ", \"iterations\": " << m.iterations << " }"
+         << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  json << "  ]\n}\n";
+
+  if (path == "-") {
+    cout << json.str();
+    return true;
+  }
+  std::ofstream file(path);
+  file << json.str();
+  return (bool)file;
+}
+
+// Reads back the files writeJSON() makes; not a general JSON parser.
+bool readJSON(const string &path, vector<Measurement> &results) {
+  std::ifstream file(path);
+  if (!file) return false;
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  string json = contents.str();
+
+  auto number = [&json](size_t from, const char *key) {
+    size_t at = json.find(key, from);
+    return at == string::npos ? 0.0 : strtod(json.c_str() + at + strlen(key), NULL);
+  };
+  results.clear();
+  const char *nameKey = "\"name\": \"";
+  for (size_t at = json.find(nameKey); at != string::npos; at = json.find(nameKey, at)) {
+    at += strlen(nameKey);
+    Measurement m = Measurement();
+    m.name = json.substr(at, json.find('"', at) - at);
+    m.nsPerOp = number(at, "\"ns_per_op\": ");
+    m.itemsPerSecond = number(at, "\"items_per_second\": ");
+    m.allocationsPerOp = number(at, "\"allocations_per_op\": ");
+    results.push_back(m);
+  }
+  return true;
+}
+
+// Prints current against baseline and returns the number of regressions:
+// time up by more than threshold percent, or more allocations per op.
+int compare(const vector<Measurement> &baseline, const vector<Measurement> &current, double threshold) {
+  int regressions = 0;
+  printf("%-20s %14s %14s %8s %12s\n", "benchmark", "baseline ns", "current ns", "change", "allocs/op");
+  for (const Measurement &m : current) {
+    auto old = std::find_if(baseline.begin(), baseline.end(),
+                            [&m](const Measurement &b) { return b.name == m.name; });
+    if (old == baseline.end()) {
+      printf("%-20s %14s %14.0f %8s %12.1f  new\n", m.name.c_str(), "-", m.nsPerOp, "", m.allocationsPerOp);
+      continue;
+    }
+    double change = (m.nsPerOp / old->nsPerOp - 1.0) * 100.0;
+    bool slower = change > threshold;
+    bool allocates = m.allocationsPerOp > old->allocationsPerOp + 0.5;
+    printf("%-20s %14.0f %14.0f %+7.1f%% %5.1f -> %-5.1f %s%s\n", m.name.c_str(), old->nsPerOp, m.nsPerOp,
+           change, old->allocationsPerOp, m.allocationsPerOp,
+           slower ? " SLOWER" : "", allocates ? " ALLOCATES" : "");
+    if (slower || allocates) regressions++;
+  }
+  return regressions;
+}
+
+int main(int argc, char *argv[]) {
+  string directory = "cmuntt/";
+  string jsonPath, baselinePath;
+  double threshold = 10.0;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-json" && i + 1 < argc) jsonPath = argv[++i];
+    else if (arg == "-compare" && i + 1 < argc) baselinePath = argv[++i];
+    else if (arg == "-threshold" && i + 1 < argc) threshold = atof(argv[++i]);
+    else directory = arg;
+  }
+  if (directory.back() != '/') directory += '/';
+
+  if (!jsonPath.empty() || !baselinePath.empty()) {
+    vector<Measurement> baseline;
+    if (!baselinePath.empty() && !readJSON(baselinePath, baseline)) {
+      cerr << "Impossible to read the baseline, " << baselinePath << endl;
+      return 2;
+    }
+    vector<Measurement> results = runSuite(directory);
+    if (!jsonPath.empty() && !writeJSON(results, jsonPath)) {
+      cerr << "Impossible to write the file, " << jsonPath << endl;
+      return 2;
+    }
+    if (baselinePath.empty()) return 0;
+    int regressions = compare(baseline, results, threshold);
+    printf("%d regressions beyond %g%%\n", regressions, threshold);
+    return regressions ? 1 : 0;
+  }
+
+  benchParsing(directory);
+  benchFrames();
+  benchBezier();
+  benchTessellationLevels();
+  benchUnicode(directory);
+  benchInstancing(directory);
+  bool labelled = benchLabels(directory);
+  bool quantized = benchQuantization(directory);
+  bool filled = benchFill(directory);
+  bool rasterFilled = benchRasterFill(directory);
+  benchPreload(directory);
+  benchDocument(directory);
+  bool hitTested = benchHitTesting(directory);
+  benchProfiler();
+  bool steady = benchSteadyFrames(directory);
+  return quantized && filled && hitTested && labelled && steady && rasterFilled ? 0 : 1;
+}
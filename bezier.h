@@ -0,0 +1,212 @@
+// ==========================================================================
+// CPU evaluation of the cubic Bezier patch stream
+//
+// Mirrors bezier() in tessEvaluation.glsl so the patches Loader builds can
+// be turned into polylines without a GPU: for headless rendering, hit
+// testing, bounds and export. A patch is 4 control points, 8 floats, in the
+// same layout the vertex buffer uses.
+//
+// Patches are evaluated one at a time with the parameter values spread
+// across SIMD lanes (AVX2 or SSE, picked at run time on x86, with a scalar
+// fallback), so every output vertex is a contiguous x/y store.
+// ==========================================================================
+
+#ifndef BEZIER_H
+#define BEZIER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BEZIER_X86 1
+#endif
+
+const int PATCH_FLOATS = 8;
+
+// Segments per patch the tessellation control shader asks for.
+const int SHADER_SEGMENTS = 16;
+
+// Bernstein basis weights for segments+1 evenly spaced parameter values,
+// padded with zeros to a multiple of 8 so SIMD loads never run off the end.
+struct BezierBasis {
+  int segments;
+  std::vector<float> b0, b1, b2, b3;
+
+  explicit BezierBasis(int n = SHADER_SEGMENTS) : segments(n) {
+    size_t padded = (n + 1 + 7) & ~7;
+    b0.assign(padded, 0.0f);
+    b1.assign(padded, 0.0f);
+    b2.assign(padded, 0.0f);
+    b3.assign(padded, 0.0f);
+    for (int i = 0; i <= n; i++) {
+      float u = (float)i / n;
+      b0[i] = (1.f-u)*(1.f-u)*(1.f-u);
+      b1[i] = 3.f*u*(1.f-u)*(1.f-u);
+      b2[i] = 3.f*u*u*(1.f-u);
+      b3[i] = u*u*u;
+    }
+  }
+};
+
+// Scalar reference: one point of the patch, exactly as the shader does it.
+inline void bezierPoint(const float *patch, float u, float &x, float &y) {
+  float B0 = (1.f-u)*(1.f-u)*(1.f-u);
+  float B1 = 3.f*u*(1.f-u)*(1.f-u);
+  float B2 = 3.f*u*u*(1.f-u);
+  float B3 = u*u*u;
+
+  x = B0*patch[0] + B1*patch[2] + B2*patch[4] + B3*patch[6];
+  y = B0*patch[1] + B1*patch[3] + B2*patch[5] + B3*patch[7];
+}
+
+// Writes the segments+1 vertices of one patch to out as x/y pairs.
+inline void evaluatePatchScalar(const float *patch, const BezierBasis &basis, float *out, int first = 0) {
+  for (int i = first; i <= basis.segments; i++) {
+    out[2*i]   = basis.b0[i]*patch[0] + basis.b1[i]*patch[2] + basis.b2[i]*patch[4] + basis.b3[i]*patch[6];
+    out[2*i+1] = basis.b0[i]*patch[1] + basis.b1[i]*patch[3] + basis.b2[i]*patch[5] + basis.b3[i]*patch[7];
+  }
+}
+
+#ifdef BEZIER_X86
+inline void evaluatePatchSSE(const float *patch, const BezierBasis &basis, float *out) {
+  __m128 x0 = _mm_set1_ps(patch[0]), y0 = _mm_set1_ps(patch[1]);
+  __m128 x1 = _mm_set1_ps(patch[2]), y1 = _mm_set1_ps(patch[3]);
+  __m128 x2 = _mm_set1_ps(patch[4]), y2 = _mm_set1_ps(patch[5]);
+  __m128 x3 = _mm_set1_ps(patch[6]), y3 = _mm_set1_ps(patch[7]);
+
+  int count = basis.segments + 1;
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 b0 = _mm_loadu_ps(&basis.b0[i]), b1 = _mm_loadu_ps(&basis.b1[i]);
+    __m128 b2 = _mm_loadu_ps(&basis.b2[i]), b3 = _mm_loadu_ps(&basis.b3[i]);
+    __m128 x = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, x0), _mm_mul_ps(b1, x1)), _mm_mul_ps(b2, x2)), _mm_mul_ps(b3, x3));
+    __m128 y = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, y0), _mm_mul_ps(b1, y1)), _mm_mul_ps(b2, y2)), _mm_mul_ps(b3, y3));
+    _mm_storeu_ps(out + 2*i, _mm_unpacklo_ps(x, y));
+    _mm_storeu_ps(out + 2*i + 4, _mm_unpackhi_ps(x, y));
+  }
+  evaluatePatchScalar(patch, basis, out, i);
+}
+
+__attribute__((target("avx2")))
+inline void evaluatePatchAVX2(const float *patch, const BezierBasis &basis, float *out) {
+  __m256 x0 = _mm256_set1_ps(patch[0]), y0 = _mm256_set1_ps(patch[1]);
+  __m256 x1 = _mm256_set1_ps(patch[2]), y1 = _mm256_set1_ps(patch[3]);
+  __m256 x2 = _mm256_set1_ps(patch[4]), y2 = _mm256_set1_ps(patch[5]);
+  __m256 x3 = _mm256_set1_ps(patch[6]), y3 = _mm256_set1_ps(patch[7]);
+
+  int count = basis.segments + 1;
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 b0 = _mm256_loadu_ps(&basis.b0[i]), b1 = _mm256_loadu_ps(&basis.b1[i]);
+    __m256 b2 = _mm256_loadu_ps(&basis.b2[i]), b3 = _mm256_loadu_ps(&basis.b3[i]);
+    __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(b0, x0), _mm256_mul_ps(b1, x1)), _mm256_mul_ps(b2, x2)), _mm256_mul_ps(b3, x3));
+    __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(b0, y0), _mm256_mul_ps(b1, y1)), _mm256_mul_ps(b2, y2)), _mm256_mul_ps(b3, y3));
+    // unpack interleaves within 128-bit lanes; permute puts the halves back in order
+    __m256 lo = _mm256_unpacklo_ps(x, y);
+    __m256 hi = _mm256_unpackhi_ps(x, y);
+    _mm256_storeu_ps(out + 2*i, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(out + 2*i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+  }
+  evaluatePatchScalar(patch, basis, out, i);
+}
+#endif
+
+enum BezierKernel { BEZIER_SCALAR, BEZIER_SSE, BEZIER_AVX2 };
+
+// Widest kernel the running CPU supports.
+inline BezierKernel bestBezierKernel() {
+#ifdef BEZIER_X86
+  static BezierKernel best = __builtin_cpu_supports("avx2") ? BEZIER_AVX2 : BEZIER_SSE;
+  return best;
+#else
+  return BEZIER_SCALAR;
+#endif
+}
+
+inline void evaluatePatch(const float *patch, const BezierBasis &basis, float *out,
+                          BezierKernel kernel = bestBezierKernel()) {
+  switch (kernel) {
+#ifdef BEZIER_X86
+    case BEZIER_AVX2: evaluatePatchAVX2(patch, basis, out); break;
+    case BEZIER_SSE: evaluatePatchSSE(patch, basis, out); break;
+#endif
+    default: evaluatePatchScalar(patch, basis, out); break;
+  }
+}
+
+// Evaluates count patches at a fixed number of segments each, like the
+// tessellation shader. Each patch becomes segments+1 vertices, appended to
+// out as x/y pairs.
+inline void evaluatePatches(const float *patches, size_t count, const BezierBasis &basis,
+                            std::vector<float> &out, BezierKernel kernel = bestBezierKernel()) {
+  size_t stride = 2 * (basis.segments + 1);
+  size_t start = out.size();
+  out.resize(start + count * stride);
+  for (size_t p = 0; p < count; p++)
+    evaluatePatch(patches + p * PATCH_FLOATS, basis, &out[start + p * stride], kernel);
+}
+
+// Number of segments that keeps a patch within tolerance of the true curve.
+// A cubic strays at most 3/4 of its control polygon's distance d from the
+// chord, and uniform subdivision into n pieces divides that by about n^2.
+// Straight segments (the promoted L and Z records) come out as 1.
+inline int flattenSegments(const float *patch, float tolerance, int maxSegments) {
+  float dx = patch[6] - patch[0];
+  float dy = patch[7] - patch[1];
+  float length = std::sqrt(dx*dx + dy*dy);
+
+  float d = 0.0f;
+  for (int i = 2; i <= 4; i += 2) {
+    float px = patch[i] - patch[0];
+    float py = patch[i+1] - patch[1];
+    float distance = length > 1e-12f ? std::fabs(px*dy - py*dx) / length : std::sqrt(px*px + py*py);
+    d = std::max(d, distance);
+  }
+
+  int n = (int)std::ceil(std::sqrt(0.75f * d / tolerance));
+  return std::min(std::max(n, 1), maxSegments);
+}
+
+// Tessellation level tessControl.glsl picks for a layout-space patch drawn
+// by render() with the given zoom and pan into a width x height viewport.
+inline int screenSegments(const float *patch, float scale, float translate,
+                          int width, int height, float tolerance, int maxLevel) {
+  float projected[PATCH_FLOATS];
+  for (int i = 0; i < PATCH_FLOATS; i += 2) {
+    projected[i]   = (scale * (patch[i] + translate) - 1.0f) * 0.5f * width;
+    projected[i+1] = scale * patch[i+1] * 0.5f * height;
+  }
+  return flattenSegments(projected, tolerance, maxLevel);
+}
+
+// Adaptive flattening: each patch gets just enough segments to stay within
+// tolerance (in the patches' own units). Vertices are appended to out as x/y
+// pairs and the vertex count of each patch's polyline to counts.
+class Flattener {
+  std::vector<BezierBasis> bases;   // bases[n] has n segments
+
+public:
+  int maxSegments;
+
+  explicit Flattener(int maxSegments = 64) : maxSegments(maxSegments) {
+    for (int n = 0; n <= maxSegments; n++) bases.push_back(BezierBasis(std::max(n, 1)));
+  }
+
+  void flatten(const float *patches, size_t count, float tolerance,
+               std::vector<float> &out, std::vector<int> &counts,
+               BezierKernel kernel = bestBezierKernel()) const {
+    for (size_t p = 0; p < count; p++) {
+      const float *patch = patches + p * PATCH_FLOATS;
+      int n = flattenSegments(patch, tolerance, maxSegments);
+      size_t start = out.size();
+      out.resize(start + 2 * (n + 1));
+      evaluatePatch(patch, bases[n], &out[start], kernel);
+      counts.push_back(n + 1);
+    }
+  }
+};
+
+#endif
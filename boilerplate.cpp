@@ -14,8 +14,11 @@
 #include <sstream>
 #include <vector>
 #include <map>
+#include <memory>
 #include <cstdio>
 #include <cstring>
+#include <chrono>
+#include <ctime>
 
 
 #define GLFW_INCLUDE_GLCOREARB
@@ -25,6 +28,22 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "allocations.h"
+#include "bvh.h"
+#include "document.h"
+#include "glbackend.h"
+#include "globjects.h"
+#include "glyphgeometry.h"
+#include "labels.h"
+#include "loader.h"
+#include "profiler.h"
+#include "sdf.h"
+#include "utf8.h"
+
+#ifdef EMBED_FONT
+#include "embeddedfont.h"
+#endif
+
 using std::string;
 using std::vector;
 using std::cout;
@@ -33,468 +52,363 @@ using std::endl;
 using std::strcmp;
 using std::fscanf;
 
-class Program {
-  GLuint vertex_shader;
-  GLuint tess_control_shader;
-  GLuint tess_evaluation_shader;
-  GLuint fragment_shader;
-
+// GLBackend that forwards every call to the OpenGL driver.
+class OpenGLBackend : public GLBackend {
 public:
-  GLuint id;
-  Program() {
-    vertex_shader=0;
-    tess_control_shader=0;
-    tess_evaluation_shader=0;
-    fragment_shader=0;
-    id=0;
+  GLuint createProgram() { return glCreateProgram(); }
+  void deleteProgram(GLuint program) { glDeleteProgram(program); }
+  void attachShader(GLuint program, GLuint shader) { glAttachShader(program, shader); }
+  void linkProgram(GLuint program) { glLinkProgram(program); }
+  GLint getProgramiv(GLuint program, GLenum pname) {
+    GLint value = 0;
+    glGetProgramiv(program, pname, &value);
+    return value;
   }
-  Program(string vertex_path, string tess_control_path, string tess_evaluation_path, string fragment_path) {
-    init(vertex_path, tess_control_path, tess_evaluation_path, fragment_path);
+  string getProgramInfoLog(GLuint program) {
+    GLint length = getProgramiv(program, GL_INFO_LOG_LENGTH);
+    string info(length, ' ');
+    glGetProgramInfoLog(program, info.length(), &length, &info[0]);
+    return info;
   }
-  void init(string vertex_path, string tess_control_path, string tess_evaluation_path, string fragment_path) {
-    id=glCreateProgram();
-    vertex_shader=addShader(vertex_path,GL_VERTEX_SHADER);
-    tess_control_shader=addShader(tess_control_path,GL_TESS_CONTROL_SHADER);
-    tess_evaluation_shader=addShader(tess_evaluation_path,GL_TESS_EVALUATION_SHADER);
-    fragment_shader=addShader(fragment_path,GL_FRAGMENT_SHADER);
-    if(vertex_shader) glAttachShader(id,vertex_shader);
-    if(tess_control_shader) glAttachShader(id,tess_control_shader);
-    if(tess_evaluation_shader) glAttachShader(id,tess_evaluation_shader);
-    if(fragment_shader) glAttachShader(id,fragment_shader);
-
-    glLinkProgram(id);
+  void programParameteri(GLuint program, GLenum pname, GLint value) { glProgramParameteri(program, pname, value); }
+  void getProgramBinary(GLuint program, vector<char> &binary, GLenum &format) {
+    binary.resize(getProgramiv(program, GL_PROGRAM_BINARY_LENGTH));
+    GLsizei length = 0;
+    glGetProgramBinary(program, binary.size(), &length, &format, binary.data());
+    binary.resize(length);
+  }
+  void programBinary(GLuint program, GLenum format, const void *binary, GLsizei length) {
+    glProgramBinary(program, format, binary, length);
+  }
+  void useProgram(GLuint program) { glUseProgram(program); }
+  GLint getUniformLocation(GLuint program, const char *name) { return glGetUniformLocation(program, name); }
+  void uniform1f(GLint location, GLfloat v0) { glUniform1f(location, v0); }
+  void uniform1i(GLint location, GLint v0) { glUniform1i(location, v0); }
+  void uniform2f(GLint location, GLfloat v0, GLfloat v1) { glUniform2f(location, v0, v1); }
+  void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+    glUniformMatrix4fv(location, count, transpose, value);
   }
-  GLuint addShader(string path, GLuint type) {
-    std::ifstream in(path);
-    string buffer = [&in]{
-      std::ostringstream ss{};
-      ss << in.rdbuf();
-      return ss.str();
-    }();
-    const char *buffer_array[]={buffer.c_str()};
-
-    GLuint shader = glCreateShader(type);
 
+  GLuint createShader(GLenum type) { return glCreateShader(type); }
+  void deleteShader(GLuint shader) { glDeleteShader(shader); }
+  void shaderSource(GLuint shader, const string &source) {
+    const char *buffer_array[]={source.c_str()};
     glShaderSource(shader, 1, buffer_array, 0);
-  	glCompileShader(shader);
-
-    // Compile results
-    GLint status;
-  	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-  	if (status == GL_FALSE)
-  	{
-  		GLint length;
-  		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
-  		string info(length, ' ');
-  		glGetShaderInfoLog(shader, info.length(), &length, &info[0]);
-  		cerr << "ERROR compiling shader:" << endl << endl;
-  		cerr << info << endl;
-  	}
-    return shader;
   }
-  ~Program() {
-    glUseProgram(0);
-    glDeleteProgram(id);
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
+  void compileShader(GLuint shader) { glCompileShader(shader); }
+  GLint getShaderiv(GLuint shader, GLenum pname) {
+    GLint value = 0;
+    glGetShaderiv(shader, pname, &value);
+    return value;
   }
-};
-
-class VertexArray {
-  std::map<string,GLuint> buffers;
-  std::map<string,int> indices;
-public:
-  GLuint id;
-  unsigned int count;
-  VertexArray(int c) {
-    glGenVertexArrays(1, &id);
-    count = c;
+  string getShaderInfoLog(GLuint shader) {
+    GLint length = getShaderiv(shader, GL_INFO_LOG_LENGTH);
+    string info(length, ' ');
+    glGetShaderInfoLog(shader, info.length(), &length, &info[0]);
+    return info;
   }
 
-  VertexArray(const VertexArray &v) {
-    glGenVertexArrays(1, &id);
-
-    // Copy data from the old object
-    this->indices = std::map<string, int>(v.indices);
-    count = v.count;
-
-    vector<GLuint> temp_buffers(v.buffers.size());
-
-    // Allocate some temporary buffer object handles
-    glGenBuffers(v.buffers.size(), &temp_buffers[0]);
-
-    // Copy each old VBO into a new VBO
-    int i = 0;
-    for(auto &ent: v.buffers) {
-      int size = 0;
-      glBindBuffer(GL_ARRAY_BUFFER, ent.second);
-      glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
-
-      glBindBuffer(GL_COPY_READ_BUFFER, temp_buffers[i]);
-      glBufferData(GL_COPY_READ_BUFFER, size, NULL, GL_STATIC_COPY);
-
-      glCopyBufferSubData(GL_ARRAY_BUFFER,GL_COPY_READ_BUFFER, 0, 0, size);
-      i++;
-    }
-
-    // Copy those temporary buffer objects into our VBOs
-
-    i = 0;
-    for(auto &ent: v.buffers) {
-      GLuint buffer_id;
-      int size = 0;
-      int index = indices[ent.first];
-
-      glGenBuffers(1, &buffer_id);
-
-      glBindVertexArray(this->id);
-      glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
-      glBindBuffer(GL_COPY_READ_BUFFER, temp_buffers[i]);
-      glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
-
-      // Allocate VBO memory and copy
-      glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
-      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, 0, size);
-      string indexs = ent.first;
-
-      buffers[ent.first] = buffer_id;
-      indices[ent.first] = index;
-
-      // Setup the attributes
-      size = size/(sizeof(float)*this->count);
-      glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, 0, 0);
-      glEnableVertexAttribArray(index);
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
-      glBindVertexArray(0);
-      i++;
-    }
-
-    // Delete temporary buffers
-    glDeleteBuffers(v.buffers.size(), &temp_buffers[0]);
+  GLuint genVertexArray() {
+    GLuint array;
+    glGenVertexArrays(1, &array);
+    return array;
   }
-
-  void addBuffer(string name, int index, vector<float> buffer) {
-    GLuint buffer_id;
-    glBindVertexArray(id);
-
-    glGenBuffers(1, &buffer_id);
-    glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
-    glBufferData(GL_ARRAY_BUFFER, buffer.size()*sizeof(float), buffer.data(), GL_STATIC_DRAW);
-    buffers[name]=buffer_id;
-    indices[name]=index;
-
-    int components=2;
-    glVertexAttribPointer(index, components, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(index);
-
-    // unset states
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+  void deleteVertexArray(GLuint array) { glDeleteVertexArrays(1, &array); }
+  void bindVertexArray(GLuint array) { glBindVertexArray(array); }
+  void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer) {
+    glVertexAttribPointer(index, size, type, normalized, stride, pointer);
   }
+  void enableVertexAttribArray(GLuint index) { glEnableVertexAttribArray(index); }
+  void vertexAttribDivisor(GLuint index, GLuint divisor) { glVertexAttribDivisor(index, divisor); }
 
-  void updateBuffer(string name, vector<float> buffer) {
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[name]);
-    glBufferData(GL_ARRAY_BUFFER, buffer.size()*sizeof(float), buffer.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  GLuint genBuffer() {
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    return buffer;
   }
-  ~VertexArray() {
-    glBindVertexArray(0);
-    glDeleteVertexArrays(1, &id);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    for(auto &ent: buffers)
-  	  glDeleteBuffers(1, &ent.second);
+  void deleteBuffer(GLuint buffer) { glDeleteBuffers(1, &buffer); }
+  void bindBuffer(GLenum target, GLuint buffer) { glBindBuffer(target, buffer); }
+  void bufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage) {
+    glBufferData(target, size, data, usage);
   }
-};
-
-class Loader {
-  string text;
-  float scalingFactor;
-  int length;
-
-public:
-  Loader(string textToDisplay){
-      text = textToDisplay;
-      length = text.length();
+  void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data) {
+    glBufferSubData(target, offset, size, data);
+  }
+  void copyBufferSubData(GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size) {
+    glCopyBufferSubData(readTarget, writeTarget, readOffset, writeOffset, size);
+  }
+  GLint getBufferSize(GLenum target) {
+    GLint size = 0;
+    glGetBufferParameteriv(target, GL_BUFFER_SIZE, &size);
+    return size;
   }
 
-  VertexArray load(float scale, float translate) {
-
-    string path = "cmuntt/gly_";
-
-    vector<float> points;
-
-    int pos = 0;
-
-    float scalingFactor = (scale / length);
-    //cout << scale << endl;
-    //float translateDistance = (1.8f / length) + 0.05f;
-    //float translateDistance = (2.0f / length) * scale;
-    float translateDistance = (2.0f) / length;
-    float initialTranslate = -1.0f/scalingFactor;
-
-    float spacing = 0.0f;
-
-    FILE * file;
-
-    for (; pos < length; pos++) {
-      int letter = text[pos];
-
-      float max = 0.0f;
-      float min = 0.0f;
-
-      //cout << letter << endl;
+  GLuint genTexture() {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    return texture;
+  }
+  void deleteTexture(GLuint texture) { glDeleteTextures(1, &texture); }
+  void activeTexture(GLenum unit) { glActiveTexture(unit); }
+  void bindTexture(GLenum target, GLuint texture) { glBindTexture(target, texture); }
+  void texParameteri(GLenum target, GLenum pname, GLint param) { glTexParameteri(target, pname, param); }
+  void pixelStorei(GLenum pname, GLint param) { glPixelStorei(pname, param); }
+  void texImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height,
+                  GLenum format, GLenum type, const void *data) {
+    glTexImage2D(target, level, internalFormat, width, height, 0, format, type, data);
+  }
+  void texBuffer(GLenum target, GLenum internalFormat, GLuint buffer) {
+    glTexBuffer(target, internalFormat, buffer);
+  }
 
-      if (letter == 32) {
-        initialTranslate = initialTranslate + spacing;
-        continue;
-      }
+  GLuint genQuery() {
+    GLuint query;
+    glGenQueries(1, &query);
+    return query;
+  }
+  void deleteQuery(GLuint query) { glDeleteQueries(1, &query); }
+  void beginQuery(GLenum target, GLuint query) { glBeginQuery(target, query); }
+  void endQuery(GLenum target) { glEndQuery(target); }
+  GLint getQueryObjectiv(GLuint query, GLenum pname) {
+    GLint value;
+    glGetQueryObjectiv(query, pname, &value);
+    return value;
+  }
+  GLuint64 getQueryObjectui64v(GLuint query, GLenum pname) {
+    GLuint64 value;
+    glGetQueryObjectui64v(query, pname, &value);
+    return value;
+  }
 
-      float startPos[2] = {};
+  string getString(GLenum name) {
+    const GLubyte *value = glGetString(name);
+    return value ? string((const char *)value) : string();
+  }
+  void clearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) { glClearColor(r, g, b, a); }
+  void clear(GLbitfield mask) { glClear(mask); }
+  void enable(GLenum capability) { glEnable(capability); }
+  void blendFunc(GLenum sfactor, GLenum dfactor) { glBlendFunc(sfactor, dfactor); }
+  void hint(GLenum target, GLenum mode) { glHint(target, mode); }
+  void viewport(GLint x, GLint y, GLsizei width, GLsizei height) { glViewport(x, y, width, height); }
+  void patchParameteri(GLenum pname, GLint value) { glPatchParameteri(pname, value); }
+  void drawArrays(GLenum mode, GLint first, GLsizei count) { glDrawArrays(mode, first, count); }
+  void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+    glDrawArraysInstanced(mode, first, count, instances);
+  }
+};
 
-      float previousEndPoint[2] = {};
+// Tessellation quality: curves stay within tessTolerance pixels of the true
+// outline, using at most maxTessLevel segments per patch.
+float tessTolerance = 0.25f;
+float maxTessLevel = 64.0f;
 
-      string letterPath = path + std::to_string(letter);
+// Scale drawGlyphs() draws at: past this zoom the 16-bit glyph coordinates
+// would show their steps.
+float drawnScale(float scale, int width)
+{
+  return std::min(scale, 2.0f * MAX_GLYPH_PIXELS / width);
+}
 
-      //cout << letterPath << endl;
+// Puts program in use with the view uniforms drawGlyphs() describes.
+void useView(Program &program, float scale, float translate, float scroll, int width, int height)
+{
+  GLBackend &gl = glBackend();
 
-      file = fopen(letterPath.c_str(),"r");
+  scale = drawnScale(scale, width);
 
-      bool openFile = true;
-      if (file == NULL) {
-          cout << "Impossible to open the file, " << letterPath << endl;
-          cout << endl;
-          openFile = false;
-      }
+  glm::mat4 identity = glm::mat4(1.0f);
+  glm::vec3 scaleVector = glm::vec3(scale, scale, 1.0f);
+  glm::vec3 translateVector = glm::vec3(translate - 1.0f / scale, scroll, 0.0f);
 
-      while (openFile) {
-        char lineType[2];
-        int res = fscanf(file, "%s", lineType);
+  glm::mat4 scaleMatrix = glm::scale(identity, scaleVector);
+  glm::mat4 translateMatrix = glm::translate(identity, translateVector);
 
-        if (res == EOF) {
-          break;
-        }
-        if (strcmp(lineType, "M") == 0) {
-          float coords[2];
-          fscanf(file, "%f %f\n", &coords[0], &coords[1]);
+	gl.useProgram(program.id);
 
-          if (max < coords[0]) max = coords[0];
-          if (min > coords[0]) min = coords[0];
+  // Uniforms apply to the program in use, so set them after binding it.
+  GLuint s_handle = gl.getUniformLocation(program.id, "S");
+  GLuint t_handle = gl.getUniformLocation(program.id, "T");
+  gl.uniformMatrix4fv(s_handle, 1, GL_FALSE, &scaleMatrix[0][0]);
+  gl.uniformMatrix4fv(t_handle, 1, GL_FALSE, &translateMatrix[0][0]);
+  gl.uniform2f(gl.getUniformLocation(program.id, "viewport"), width, height);
+  gl.uniform1f(gl.getUniformLocation(program.id, "tolerance"), tessTolerance);
+  gl.uniform1f(gl.getUniformLocation(program.id, "maxLevel"), maxTessLevel);
+}
 
-          coords[0] = coords[0] + initialTranslate + translate;
+// Draws the glyphs in geometry over what is on screen. scale maps glyph
+// units to clip space, translate pans and scroll moves down, both in glyph
+// units; the first glyph starts at the left edge.
+// width and height are the framebuffer size, which the tessellation control
+// shader uses to pick a level per patch.
+void drawGlyphs(Program &program, GlyphGeometry &geometry, float scale, float translate, float scroll,
+                int width, int height)
+{
+  useView(program, scale, translate, scroll, width, height);
+	geometry.draw();
+	glBackend().useProgram(0);
+}
 
-          coords[0] = coords[0] * scalingFactor;
-          coords[1] = coords[1] * scalingFactor;
-
-          // coords[1] = coords[1] + initialTranslate;
-          startPos[0] = coords[0];
-          startPos[1] = coords[1];
-          previousEndPoint[0] = coords[0];
-          previousEndPoint[1] = coords[1];
+// Draws every label in batch over what is on screen, in the view
+// drawGlyphs() takes, with labelVertex.glsl.
+void drawLabels(Program &program, LabelBatch &batch, float scale, float translate, float scroll,
+                int width, int height)
+{
+  GLBackend &gl = glBackend();
+  useView(program, scale, translate, scroll, width, height);
+  gl.uniform1f(gl.getUniformLocation(program.id, "quantum"), GLYPH_QUANTUM);
+  gl.uniform1i(gl.getUniformLocation(program.id, "labels"), 0);
+  batch.draw();
+  gl.useProgram(0);
+}
 
-          //cout << "M" << endl;
-          //cout << coords[0] << ", " << coords[1] << endl;
-          //cout << endl;
-        } else if (strcmp(lineType, "C") == 0) {
-          float point1[2];
-          float point2[2];
-          float point3[2];
-          fscanf(file, "%f %f %f %f %f %f",
-              &point1[0], &point1[1],
-              &point2[0], &point2[1],
-              &point3[0], &point3[1]);
-
-          if (max < point1[0]) max = point1[0];
-          if (min > point1[0]) min = point1[0];
-
-          if (max < point2[0]) max = point2[0];
-          if (min > point2[0]) min = point2[0];
-
-          if (max < point2[0]) max = point2[0];
-          if (min > point2[0]) min = point2[0];
-
-          point1[0] = point1[0] + initialTranslate + translate;
-          point2[0] = point2[0] + initialTranslate + translate;
-          point3[0] = point3[0] + initialTranslate + translate;
-
-          point1[0] = point1[0] * scalingFactor;
-          point2[0] = point2[0] * scalingFactor;
-          point3[0] = point3[0] * scalingFactor;
-
-          point1[1] = point1[1] * scalingFactor;
-          point2[1] = point2[1] * scalingFactor;
-          point3[1] = point3[1] * scalingFactor;
-
-          // point1[1] = point1[1] + initialTranslate;
-          // point2[1] = point2[1] + initialTranslate;
-          // point3[1] = point3[1] + initialTranslate;
-
-          points.push_back(previousEndPoint[0]);
-          points.push_back(previousEndPoint[1]);
-          points.push_back(point1[0]);
-          points.push_back(point1[1]);
-          points.push_back(point2[0]);
-          points.push_back(point2[1]);
-          points.push_back(point3[0]);
-          points.push_back(point3[1]);
-
-          //cout << "C" << endl;
-
-          //cout << previousEndPoint[0] << ", " << previousEndPoint[1] << endl;
-          //cout << point1[0] << ", " << point1[1] << endl;
-          //cout << point2[0] << ", " << point2[1] << endl;
-          //cout << point3[0] << ", " << point3[1] << endl;
-
-          //cout << endl;
-
-          previousEndPoint[0] = point3[0];
-          previousEndPoint[1] = point3[1];
-        } else if (strcmp(lineType, "L") == 0) {
-          float point0[2] = {};
-          point0[0] = previousEndPoint[0];
-          point0[1] = previousEndPoint[1];
-          float point1[2];
-
-          fscanf(file, "%f %f", &point1[0], &point1[1]);
-
-          if (max < point1[0]) max = point1[0];
-          if (min > point1[0]) min = point1[0];
-
-          float middle1[2] = {};
-          float middle2[2] = {};
-
-          point1[0] = point1[0] + initialTranslate + translate;
-
-          point1[0] = point1[0] * scalingFactor;
-          point1[1] = point1[1] * scalingFactor;
-
-          //point1[1] = point1[1] + initialTranslate;
-
-          middle1[0] = point0[0] * 0.75 + point1[0] * 0.25;
-          middle1[1] = point0[1] * 0.75 + point1[1] * 0.25;
-
-          middle2[0] = point0[0] * 0.25 + point1[0] * 0.75;
-          middle2[1] = point0[1] * 0.25 + point1[1] * 0.75;
-
-          // middle1[1] = middle1[1] + initialTranslate;
-          // middle2[1] = middle2[1] + initialTranslate;
-          // point1[1] = point1[1] + initialTranslate;
-
-          points.push_back(point0[0]);
-          points.push_back(point0[1]);
-          points.push_back(middle1[0]);
-          points.push_back(middle1[1]);
-          points.push_back(middle2[0]);
-          points.push_back(middle2[1]);
-          points.push_back(point1[0]);
-          points.push_back(point1[1]);
-
-          previousEndPoint[0] = point1[0];
-          previousEndPoint[1] = point1[1];
-
-          //cout << "L" << endl;
-          //cout << point0[0] << ", " << point0[1] << endl;
-          //cout << point1[0] << ", " << point1[1] << endl;
-          //cout << endl;
-        }
-        else if (strcmp(lineType, "Z") == 0) {
-          float point0[2] = {};
-          point0[0] = previousEndPoint[0];
-          point0[1] = previousEndPoint[1];
-          float point1[2] = {};
-          point1[0] = startPos[0];
-          point1[1] = startPos[1];
-
-          float middle1[2] = {};
-          float middle2[2] = {};
-
-          middle1[0] = point0[0] * 0.75 + point1[0] * 0.25;
-          middle1[1] = point0[1] * 0.75 + point1[1] * 0.25;
-
-          middle2[0] = point0[0] * 0.25 + point1[0] * 0.75;
-          middle2[1] = point0[1] * 0.25 + point1[1] * 0.75;
-
-          // middle1[1] = middle1[1] + initialTranslate;
-          // middle2[1] = middle2[1] + initialTranslate;
-          // point1[1] = point1[1] + initialTranslate;
-
-          points.push_back(point0[0]);
-          points.push_back(point0[1]);
-          points.push_back(middle1[0]);
-          points.push_back(middle1[1]);
-          points.push_back(middle2[0]);
-          points.push_back(middle2[1]);
-          points.push_back(point1[0]);
-          points.push_back(point1[1]);
-
-          //cout << "Z" << endl;
-          //cout << point0[0] << ", " << point0[1] << endl;
-          //cout << point1[0] << ", " << point1[1] << endl;
-          //cout << endl;
-        }
-      }
+// Adds count labels in a few colours, scattered over width by height glyph
+// units below and to the right of the origin.
+void scatterLabels(LabelBatch &batch, int count, float width, float height)
+{
+  static const float colours[][4] = { { 1.0f, 0.4f, 0.3f, 1.0f }, { 0.4f, 0.9f, 0.4f, 1.0f },
+                                      { 0.4f, 0.6f, 1.0f, 1.0f }, { 1.0f, 0.85f, 0.3f, 1.0f },
+                                      { 0.8f, 0.5f, 1.0f, 1.0f }, { 0.3f, 0.9f, 0.9f, 1.0f } };
+  unsigned seed = 1;
+  auto random = [&seed]() {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) & 0xffff) / 65535.0f;
+  };
+  for (int i = 0; i < count; i++) {
+    float x = random() * width, y = (random() - 1.0f) * height, scale = 0.2f + 0.3f * random();
+    batch.add("label " + std::to_string(i), x, y, scale, colours[i % 6]);
+  }
+}
 
-      fclose(file);
+// Clears the screen and draws the glyphs in geometry, as drawGlyphs().
+void render(Program &program, GlyphGeometry &geometry, float scale, float translate, float scroll,
+            int width, int height)
+{
+  GLBackend &gl = glBackend();
 
-      if (max < 0) max = -max;
-      if (min < 0) min = -min;
+	// clear screen to a dark grey colour
+	gl.clearColor(0.2f, 0.2f, 0.2f, 1.0f);
+	gl.clear(GL_COLOR_BUFFER_BIT);
 
-      float width = max + min;
+  // Line smoothing hints.
+  gl.enable (GL_LINE_SMOOTH);
+	gl.enable (GL_BLEND);
+	gl.blendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl.hint (GL_LINE_SMOOTH_HINT, GL_DONT_CARE);
 
-      spacing = width + width / length;
+  drawGlyphs(program, geometry, scale, translate, scroll, width, height);
+}
 
-      initialTranslate = initialTranslate + spacing;
+// p50 and p99 of every phase in ms, one line each, for the HUD. Written
+// over text, whose storage is reused.
+void profileSummary(Profiler &profiler, string &text)
+{
+  text = "         cpu p50    p99   gpu p50    p99";
+  char line[64];
+  for (int phase = 0; phase < PHASE_COUNT; phase++) {
+    float p50, p99;
+    snprintf(line, sizeof(line), "\n%-8s", PHASE_NAMES[phase]);
+    text += line;
+    for (int gpu = 0; gpu < 2; gpu++) {
+      if (profiler.percentiles((ProfilePhase)phase, gpu, p50, p99))
+        snprintf(line, sizeof(line), " %7.2f %6.2f ", p50, p99);
+      else
+        snprintf(line, sizeof(line), " %7s %6s ", "-", "-");
+      text += line;
     }
-
-    VertexArray va(points.size() / 2);
-
-    va.addBuffer("v", 0, points);
-
-    return va;
   }
-};
+}
 
-void render(Program &program, VertexArray &va)
+// Draws the glyph quads in quads, shading them from the distance field in
+// atlas. Takes the same zoom and pan as render().
+void renderSDF(Program &program, VertexArray &quads, Texture &atlas, float scale, float translate)
 {
-	// clear screen to a dark grey colour
-	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT);
+  GLBackend &gl = glBackend();
 
-  // Line smoothing hints.
-  glEnable (GL_LINE_SMOOTH);
-	glEnable (GL_BLEND);
-	glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glHint (GL_LINE_SMOOTH_HINT, GL_DONT_CARE);
+  gl.clearColor(0.2f, 0.2f, 0.2f, 1.0f);
+  gl.clear(GL_COLOR_BUFFER_BIT);
+  gl.enable(GL_BLEND);
+  gl.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
   glm::mat4 identity = glm::mat4(1.0f);
-  glm::vec3 scaleVector = glm::vec3(0.5f, 0.5f, 0.0f);
-  glm::vec3 translateVector = glm::vec3(0.5f, 0.5f, 0.0f);
-
-  glm::mat4 scaleMatrix = glm::scale(identity, scaleVector);
-  glm::mat4 translateMatrix = glm::translate(identity, translateVector);
+  glm::mat4 scaleMatrix = glm::scale(identity, glm::vec3(scale, scale, 1.0f));
+  glm::mat4 translateMatrix = glm::translate(identity, glm::vec3(translate - 1.0f / scale, 0.0f, 0.0f));
+
+  gl.useProgram(program.id);
+  gl.uniformMatrix4fv(gl.getUniformLocation(program.id, "S"), 1, GL_FALSE, &scaleMatrix[0][0]);
+  gl.uniformMatrix4fv(gl.getUniformLocation(program.id, "T"), 1, GL_FALSE, &translateMatrix[0][0]);
+  gl.uniform1i(gl.getUniformLocation(program.id, "field"), 0);
+  gl.activeTexture(GL_TEXTURE0);
+  gl.bindTexture(GL_TEXTURE_2D, atlas.id);
+
+  gl.bindVertexArray(quads.id);
+  gl.drawArrays(GL_TRIANGLES, 0, quads.count);
+
+  gl.bindVertexArray(0);
+  gl.bindTexture(GL_TEXTURE_2D, 0);
+  gl.useProgram(0);
+}
 
-  GLuint s_handle = glGetUniformLocation(program.id, "S");
-  GLuint t_handle = glGetUniformLocation(program.id, "T");
-  glUniformMatrix4fv(s_handle, 1, GL_FALSE, &scaleMatrix[0][0]);
-  glUniformMatrix4fv(t_handle, 1, GL_FALSE, &translateMatrix[0][0]);
+float scalingFactor = 3.0f;
+float translationFactor = 0.0f;
+float scrollLines = 0.0f;
 
+// Documents are zoomed to fit this many columns instead of the longest line.
+const int documentColumns = 80;
 
-	glUseProgram(program.id);
-	glBindVertexArray(va.id);
+// S switches between tessellated outlines and the distance field atlas.
+bool sdfMode = false;
 
-  glPatchParameteri( GL_PATCH_VERTICES, 4 );
-	glDrawArrays( GL_PATCHES, 0, va.count );
+// F switches between outlines and filled glyphs.
+bool fillMode = false;
 
-	glBindVertexArray(0);
-	glUseProgram(0);
+// The mouse picks characters: the one under the cursor is named in the
+// title bar, a click prints it and a drag copies those in the box it
+// spans. The callbacks only note what happened; the loop answers.
+const char *windowTitle = "CPSC 453 OpenGL Tessellation Boilerplate";
+double cursorX = 0.0, cursorY = 0.0;   // window coordinates
+double pressX = 0.0, pressY = 0.0;
+bool cursorMoved = false, mouseReleased = false;
 
+// The text of the glyphs at selection in hits, in text order: line breaks
+// and spaces are put back from the gaps between them.
+string selectedText(GlyphBVH &hits, const vector<size_t> &selection, LayoutEngine &layouts)
+{
+  string text;
+  const GlyphPlacement *last = 0;
+  for (size_t i : selection) {
+    const GlyphPlacement &g = hits.placement(i);
+    if (last && g.y != last->y) {
+      text.append(std::max(1L, std::lround((last->y - g.y) / layouts.lineHeight)), '\n');
+    } else if (last) {
+      float gap = g.x - last->x - layouts.advance(last->code);
+      text.append(std::max(0L, std::lround(gap / layouts.spaceAdvance)), ' ');
+    }
+    appendUTF8(g.code, text);
+    last = &g;
+  }
+  return text;
 }
 
-float scalingFactor = 3.0f;
-float translationFactor = 0.0f;
+// H shows the profiler's per phase times; P writes its samples to a file.
+bool showHUD = false;
+bool dumpProfile = false;
+
+// What changed since the last frame. The loop sleeps until something is
+// dirty, then reruns only the stages downstream of it.
+enum {
+  DIRTY_TEXT = 1,        // the string or document: lay it out again
+  DIRTY_LAYOUT = 2,      // which glyphs are placed where: upload instances
+  DIRTY_TRANSFORM = 4,   // zoom, pan or scroll: new uniforms, culling for documents
+  DIRTY_SIZE = 8,        // framebuffer size: viewport, tessellation levels
+  DIRTY_DISPLAY = 16     // anything else on screen: just redraw
+};
+unsigned dirty = DIRTY_TEXT | DIRTY_SIZE;
 
 
 int main(int argc, char *argv[])
 {
+  std::chrono::steady_clock::time_point launched = std::chrono::steady_clock::now();
+
 	// initialize the GLFW windowing system
 	if (!glfwInit()) {
 		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
@@ -511,7 +425,7 @@ int main(int argc, char *argv[])
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	window = glfwCreateWindow(768, 768, "CPSC 453 OpenGL Tessellation Boilerplate", 0, 0);
+	window = glfwCreateWindow(768, 768, windowTitle, 0, 0);
 	if (!window) {
 		cout << "Program failed to create GLFW window, TERMINATING" << endl;
 		glfwTerminate();
@@ -519,8 +433,22 @@ int main(int argc, char *argv[])
 	}
 
 	glfwMakeContextCurrent(window);
+	glfwSwapInterval(1);
+
+  OpenGLBackend openGL;
+  setGLBackend(&openGL);
 
+  // Linked programs are cached here, so later runs skip compiling
+  programCacheDirectory() = "programs/";
+  std::chrono::steady_clock::time_point programStart = std::chrono::steady_clock::now();
   Program p("vertex.glsl", "tessControl.glsl", "tessEvaluation.glsl", "fragment.glsl");
+  if (!p.linked) {
+    glfwTerminate();
+    return 1;
+  }
+  cout << "Program " << (p.cached ? "loaded from the cache" : "compiled") << " in "
+       << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - programStart).count()
+       << " ms" << endl;
   //VertexArray va(4);
   // va.addBuffer("v", 0, vector<float>{
   //   -1.0,-1.0,
@@ -530,43 +458,397 @@ int main(int argc, char *argv[])
   // });
 
 
-    Loader l("The quick brown fox jumps over the lazy dog");
-    if (argc == 2) {
-      l = Loader(argv[1]);
+    // boilerplate [text]
+    // boilerplate -file path views a whole text file, laid out and drawn
+    // only where it is on screen.
+    // -profile out.csv|out.json names the file P writes to, and writes it
+    // on exit too.
+    // -font directory/ or -font file.pack reads the glyphs from there
+    // instead of cmuntt/, or instead of the font built in with EMBED_FONT.
+    // -preload all|32-126,... reads those glyphs on every core in the
+    // background; text shows up as its glyphs arrive.
+    // -labels n scatters n coloured labels over the view, drawn as one
+    // batch.
+    string text = "The quick brown fox jumps over the lazy dog";
+    string file, fontPath, preloadRanges, profilePath = "profile.csv";
+    bool profileOnExit = false;
+    int labelCount = 0;
+    for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-file") == 0 && i + 1 < argc) file = argv[++i];
+      else if (strcmp(argv[i], "-font") == 0 && i + 1 < argc) fontPath = argv[++i];
+      else if (strcmp(argv[i], "-preload") == 0 && i + 1 < argc) preloadRanges = argv[++i];
+      else if (strcmp(argv[i], "-labels") == 0 && i + 1 < argc) labelCount = atoi(argv[++i]);
+      else if (strcmp(argv[i], "-profile") == 0 && i + 1 < argc) {
+        profilePath = argv[++i];
+        profileOnExit = true;
+      }
+      else text = argv[i];
+    }
+
+    Profiler profiler(true);
+    profiler.begin(PHASE_LOAD);
+
+    // Declared before the cache, which waits for the preload when destroyed
+    std::unique_ptr<ThreadPool> preloadPool;
+    std::unique_ptr<GlyphCache> font;
+#ifdef EMBED_FONT
+    if (fontPath.empty()) font.reset(new GlyphCache(EMBEDDED_FONT));
+#endif
+    if (!font && fontPath.empty()) font.reset(new GlyphCache());
+    bool packed = fontPath.size() > 5 && fontPath.compare(fontPath.size() - 5, 5, ".pack") == 0;
+    if (!font && packed) font.reset(new GlyphCache("", fontPath));
+    if (!font) font.reset(new GlyphCache(fontPath.back() == '/' ? fontPath : fontPath + "/", ""));
+    GlyphCache &glyphs = *font;
+    LayoutEngine layouts(glyphs);
+
+    std::chrono::steady_clock::time_point preloadStart = std::chrono::steady_clock::now();
+    size_t preloadCount = 0;
+    if (!preloadRanges.empty()) {
+      // The calling thread only works inside parallelFor(), so a worker per
+      // core takes one more
+      preloadPool.reset(new ThreadPool(std::max(1u, std::thread::hardware_concurrency()) + 1));
+      bool all = preloadRanges == "all";
+      vector<int> codes;
+      if (!all)
+        for (int code = 0; code <= GlyphTable::MAX_CODE; code++)
+          if (glyphs.contains(code) && inCodeRanges(code, preloadRanges)) codes.push_back(code);
+      preloadCount = all ? glyphs.size() : codes.size();
+      // Wakes the loop so arrivals get drawn
+      glyphs.preloadAsync(*preloadPool, all, codes, [] { glfwPostEmptyEvent(); });
     }
+    Loader l(text, layouts);
+
+    std::unique_ptr<Document> document;
+    TextLayout visibleText;
+    if (!file.empty()) {
+      document.reset(new Document(layouts));
+      if (!document->open(file)) {
+        cerr << "Impossible to open the file, " << file << endl;
+        preloadPool.reset();
+        glfwTerminate();
+        return 1;
+      }
+      cout << "Document: " << document->size() << " bytes, " << document->lines() << " lines, "
+           << document->chunkCount() << " chunks" << endl;
+    }
+    profiler.end(PHASE_LOAD);
 
     //Loader l("Hello");
 
+    // Glyph geometry is uploaded once per glyph; the text only sets the
+    // instances.
+    GlyphGeometry geometry(glyphs);
+
+    // Filled glyphs are triangulated as they are first shown and drawn
+    // without the tessellation stages, which are set up when first needed.
+    GlyphGeometry filled(glyphs, true);
+    std::unique_ptr<Program> fillProgram;
+
+    // The HUD is drawn with the same glyphs, at a fixed size in the top
+    // left corner. It is left out of the phases it reports.
+    GlyphGeometry hud(glyphs);
+    const float hudScale = 0.05f;
+    string hudText;
+    TextLayout hudLayout;
+
+    // The distance field path is set up the first time it is switched on.
+    SDFAtlas atlas;
+    std::unique_ptr<Program> sdfProgram;
+    std::unique_ptr<Texture> sdfTexture;
+    std::unique_ptr<VertexArray> sdfQuads;
+
+    std::unique_ptr<LabelBatch> labels;
+    std::unique_ptr<Program> labelProgram;
+    if (labelCount > 0) {
+      labels.reset(new LabelBatch(layouts));
+      labelProgram.reset(new Program("labelVertex.glsl", "tessControl.glsl", "tessEvaluation.glsl", "fragment.glsl"));
+      float width = 2.0f * (document ? documentColumns : l.textLength()) / scalingFactor;
+      scatterLabels(*labels, labelCount, width, 0.5f * width);
+    }
+
+    // What is on screen, for the mouse.
+    GlyphBVH hits(glyphs);
+    long hovered = -1;
+    string title;
+
   glfwSetKeyCallback(window,
     [](GLFWwindow* window, int key, int scancode, int action, int mode){
 
         //Translation controls
         if (key == GLFW_KEY_UP && (action == GLFW_PRESS || action == GLFW_REPEAT)) {
           scalingFactor = scalingFactor + 0.05f;
+          dirty |= DIRTY_TRANSFORM;
         }
         if (key == GLFW_KEY_DOWN && (action == GLFW_PRESS || action == GLFW_REPEAT)) {
           scalingFactor = scalingFactor - 0.05f;
+          dirty |= DIRTY_TRANSFORM;
         }
         if (key == GLFW_KEY_LEFT && (action == GLFW_PRESS || action == GLFW_REPEAT)) {
           translationFactor = translationFactor - 0.05f;
+          dirty |= DIRTY_TRANSFORM;
         }
         if (key == GLFW_KEY_RIGHT && (action == GLFW_PRESS || action == GLFW_REPEAT)) {
           translationFactor = translationFactor + 0.05f;
+          dirty |= DIRTY_TRANSFORM;
+        }
+        if (key == GLFW_KEY_PAGE_UP && (action == GLFW_PRESS || action == GLFW_REPEAT)) {
+          scrollLines = std::max(0.0f, scrollLines - 20.0f);
+          dirty |= DIRTY_TRANSFORM;
+        }
+        if (key == GLFW_KEY_PAGE_DOWN && (action == GLFW_PRESS || action == GLFW_REPEAT)) {
+          scrollLines = scrollLines + 20.0f;
+          dirty |= DIRTY_TRANSFORM;
+        }
+        if (key == GLFW_KEY_S && action == GLFW_PRESS) {
+          sdfMode = !sdfMode;
+          dirty |= DIRTY_DISPLAY;
+        }
+        if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+          fillMode = !fillMode;
+          dirty |= DIRTY_LAYOUT;
+        }
+        if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+          showHUD = !showHUD;
+          dirty |= DIRTY_DISPLAY;
+        }
+        if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+          dumpProfile = true;
         }
     });
 
-	// run an event-triggered main loop
+  glfwSetFramebufferSizeCallback(window, [](GLFWwindow *, int, int) { dirty |= DIRTY_SIZE; });
+  glfwSetWindowRefreshCallback(window, [](GLFWwindow *) { dirty |= DIRTY_DISPLAY; });
+  glfwSetCursorPosCallback(window, [](GLFWwindow *, double x, double y) {
+    cursorX = x;
+    cursorY = y;
+    cursorMoved = true;
+  });
+  glfwSetMouseButtonCallback(window, [](GLFWwindow *, int button, int action, int) {
+    if (button != GLFW_MOUSE_BUTTON_LEFT) return;
+    if (action == GLFW_PRESS) {
+      pressX = cursorX;
+      pressY = cursorY;
+    } else if (action == GLFW_RELEASE) {
+      mouseReleased = true;
+    }
+  });
+
+  unsigned frames = 0;
+  double firstFrame = 0.0;   // ms from launch
+  unsigned long glyphGeneration = glyphs.generation(), glyphsSkipped = 0;
+  bool preloadReported = !preloadPool;
+  double hudRefreshed = 0.0;
+  // Frames after the first that allocated on the heap, and how often, when
+  // built with COUNT_ALLOCATIONS (make counted). A GL driver written in C++
+  // counts too; Mesa's software one allocates in every draw.
+  unsigned allocatingFrames = 0;
+  unsigned long long frameAllocations = 0;
+  double start = glfwGetTime();
+  std::clock_t startCPU = std::clock();
+
+	// run an event-triggered main loop: sleep until an event makes something
+	// dirty. glfwWaitEvents() handles every queued event before returning,
+	// so a burst of key repeats costs one frame, and vsync caps the rate.
 	while (!glfwWindowShouldClose(window))
 	{
+    if (dumpProfile) {
+      dumpProfile = false;
+      if (profiler.dump(profilePath)) cout << "Wrote " << profilePath << endl;
+      else cerr << "Impossible to write the file, " << profilePath << endl;
+    }
+    // Preloaded glyphs arrived: lay out again if the text went without some
+    if (glyphs.generation() != glyphGeneration) {
+      glyphGeneration = glyphs.generation();
+      if (glyphs.skipped != glyphsSkipped) {
+        glyphsSkipped = glyphs.skipped;
+        layouts.clear();
+        hits.clear();
+        if (document) document->relayout();
+        dirty |= DIRTY_TEXT;
+      }
+    }
+    if (!preloadReported && !glyphs.preloading()) {
+      preloadReported = true;
+      cout << "Preloaded " << preloadCount << " glyphs on " << preloadPool->size() - 1 << " threads, ready within "
+           << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - preloadStart).count()
+           << " ms" << endl;
+    }
+    if (cursorMoved || mouseReleased) {
+      // Window coordinates to layout space, by the transform on screen
+      int windowWidth, windowHeight, width, height;
+      glfwGetWindowSize(window, &windowWidth, &windowHeight);
+      glfwGetFramebufferSize(window, &width, &height);
+      float scale = scalingFactor / (document ? documentColumns : l.textLength());
+      float scroll = document ? scrollLines * layouts.lineHeight : 0.0f;
+      if (document || !sdfMode) scale = drawnScale(scale, width);
+      auto toLayout = [&](double x, double y, float &lx, float &ly) {
+        lx = (2.0 * x / windowWidth) / scale - translationFactor;
+        ly = (1.0 - 2.0 * y / windowHeight) / scale - scroll;
+      };
+      float x, y;
+      toLayout(cursorX, cursorY, x, y);
+      float pixel = 2.0f / (windowWidth * scale);
+
+      if (mouseReleased && std::hypot(cursorX - pressX, cursorY - pressY) > 4.0) {
+        float x0, y0;
+        toLayout(pressX, pressY, x0, y0);
+        float box[4] = { std::min(x0, x), std::min(y0, y), std::max(x0, x), std::max(y0, y) };
+        vector<size_t> selection;
+        hits.select(box, selection);
+        string text = selectedText(hits, selection, layouts);
+        glfwSetClipboardString(window, text.c_str());
+        cout << "Copied " << selection.size() << " characters" << endl;
+      } else {
+        long picked = hits.pick(x, y, 4.0f * pixel);
+        if (picked != hovered) {
+          hovered = picked;
+          title = windowTitle;
+          if (picked >= 0) {
+            char code[16];
+            snprintf(code, sizeof(code), "U+%04X", hits.placement(picked).code);
+            title += " - ";
+            appendUTF8(hits.placement(picked).code, title);
+            title += ' ';
+            title += code;
+          }
+          glfwSetWindowTitle(window, title.c_str());
+        }
+        if (mouseReleased && picked >= 0) {
+          string character;
+          appendUTF8(hits.placement(picked).code, character);
+          cout << "Picked " << character << " at glyph " << picked << endl;
+        }
+      }
+      cursorMoved = mouseReleased = false;
+    }
+    if (!dirty) {
+      // The HUD still wants a new frame twice a second while idle
+      if (!showHUD) {
+        glfwWaitEvents();
+      } else {
+        glfwWaitEventsTimeout(0.5);
+        dirty |= DIRTY_DISPLAY;
+      }
+      continue;
+    }
+    profiler.beginFrame();
+    frames++;
+    unsigned long long allocatedBefore = allocationCount();
+
+    if (dirty & DIRTY_TEXT) {
+      ScopedPhase phase(profiler, PHASE_LAYOUT);
+      if (!document) l.layout();
+      dirty |= DIRTY_LAYOUT;
+    }
+    if (document && (dirty & (DIRTY_TEXT | DIRTY_TRANSFORM))) {
+      // The view in document glyph units, from the transform render() uses
+      float scale = scalingFactor / documentColumns;
+      float scroll = scrollLines * layouts.lineHeight;
+      float view[4] = { -translationFactor, -1.0f / scale - scroll,
+                        2.0f / scale - translationFactor, 1.0f / scale - scroll };
+      ScopedPhase phase(profiler, PHASE_LAYOUT);
+      if (document->visible(view, visibleText)) dirty |= DIRTY_LAYOUT;
+    }
+    if (fillMode && !fillProgram) fillProgram.reset(new Program("vertex.glsl", "fragment.glsl"));
+    Program &program = fillMode ? *fillProgram : p;
+    GlyphGeometry &shown = fillMode ? filled : geometry;
+    if (dirty & DIRTY_LAYOUT) {
+      ScopedPhase phase(profiler, PHASE_UPLOAD);
+      shown.setText(document ? visibleText : l.layout());
+      // Rebuilt from the new layout when next drawn
+      sdfQuads.reset();
+    }
+    if (dirty & DIRTY_LAYOUT) {
+      ScopedPhase phase(profiler, PHASE_LAYOUT);
+      hits.update(document ? visibleText : l.layout());
+    }
+    if (dirty & DIRTY_SIZE) {
+      int width, height;
+      glfwGetFramebufferSize(window, &width, &height);
+      glBackend().viewport(0, 0, width, height);
+    }
+    dirty = 0;
+
     // render
-    VertexArray va = l.load(scalingFactor, translationFactor);
-		render(p,va);
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    if (document) {
+      float scale = scalingFactor / documentColumns;
+      float scroll = scrollLines * layouts.lineHeight;
+      ScopedPhase phase(profiler, PHASE_DRAW, true);
+      render(program, shown, scale, translationFactor, scroll, width, height);
+      if (labels) drawLabels(*labelProgram, *labels, scale, translationFactor, scroll, width, height);
+    } else if (sdfMode) {
+      if (!sdfProgram) {
+        ScopedPhase phase(profiler, PHASE_LOAD);
+        ThreadPool pool;
+        bool cached = loadOrBuildSDFAtlas(glyphs, 48, 4, "cmuntt.sdf", pool, atlas);
+        cout << (cached ? "Loaded" : "Built") << " distance field atlas, "
+             << atlas.width << "x" << atlas.height << endl;
+
+        sdfProgram.reset(new Program("sdfVertex.glsl", "sdfFragment.glsl"));
+        sdfTexture.reset(new Texture(atlas.width, atlas.height, atlas.pixels.data()));
+      }
+      if (!sdfQuads) {
+        ScopedPhase phase(profiler, PHASE_UPLOAD);
+        vector<float> positions, texCoords;
+        buildSDFQuads(atlas, l.layout(), positions, texCoords);
+        sdfQuads.reset(new VertexArray(positions.size() / 2));
+        sdfQuads->addBuffer("v", 0, positions);
+        sdfQuads->addBuffer("uv", 1, texCoords);
+      }
+      ScopedPhase phase(profiler, PHASE_DRAW, true);
+      renderSDF(*sdfProgram, *sdfQuads, *sdfTexture, scalingFactor / l.textLength(), translationFactor);
+    } else {
+      ScopedPhase phase(profiler, PHASE_DRAW, true);
+		  render(program, shown, scalingFactor / l.textLength(), translationFactor, 0.0f, width, height);
+      if (labels) drawLabels(*labelProgram, *labels, scalingFactor / l.textLength(), translationFactor, 0.0f, width, height);
+    }
 
-		glfwSwapBuffers(window);
+    if (showHUD) {
+      // Percentiles change slowly; refreshing twice a second is plenty
+      double now = glfwGetTime();
+      if (now - hudRefreshed >= 0.5 || hud.glyphCount() == 0) {
+        // Laid out outside the engine's cache, which it would only churn
+        profileSummary(profiler, hudText);
+        layouts.layout(hudText, 0.0f, hudLayout);
+        hud.setText(hudLayout);
+        hudRefreshed = now;
+      }
+      drawGlyphs(p, hud, hudScale, 0.0f, 1.0f / hudScale - 1.0f, width, height);
+    }
 
-		glfwPollEvents();
+    {
+      ScopedPhase phase(profiler, PHASE_SWAP);
+		  glfwSwapBuffers(window);
+    }
+    if (frames == 1)
+      firstFrame = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - launched).count();
+    else if (allocationCount() != allocatedBefore) {
+      allocatingFrames++;
+      frameAllocations += allocationCount() - allocatedBefore;
+    }
 	}
 
+  double seconds = glfwGetTime() - start, cpu = (double)(std::clock() - startCPU) / CLOCKS_PER_SEC;
+  printf("Rendered %u frames in %.2f s using %.2f s of CPU (%.1f%%), the first %.1f ms after launch\n",
+         frames, seconds, cpu, 100.0 * cpu / seconds, firstFrame);
+
+#ifdef COUNT_ALLOCATIONS
+  printf("%u of the frames after the first allocated, %llu heap allocations between them\n",
+         allocatingFrames, frameAllocations);
+#endif
+
+  if (profileOnExit && !profiler.dump(profilePath))
+    cerr << "Impossible to write the file, " << profilePath << endl;
+
+  cout << "Glyph cache: " << glyphs.hits << " hits, "
+       << glyphs.misses << " misses, " << glyphs.skipped << " skipped while preloading" << endl;
+
+  // Joins the preload's workers, whose batches wake GLFW, while it is up;
+  // batches not started yet are dropped
+  preloadPool.reset();
+
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
@@ -0,0 +1,412 @@
+// ==========================================================================
+// Bounding volume hierarchy over laid-out glyphs, for hit testing
+//
+// Answers which character is under a point and which characters lie in a
+// rectangle, in layout space, in logarithmic time. There are three levels
+// of the same box tree:
+//
+//   - a tree over blocks of up to BLOCK_GLYPHS consecutive placements,
+//   - in each block, a tree over its glyphs' bounds,
+//   - per glyph code, shared by every placement of it, a tree over its
+//     patches' bounds in glyph space.
+//
+// A patch's exact bound is the convex hull of its 4 control points, which
+// the curve never leaves; the trees hold the hulls' boxes and points are
+// tested against the hulls themselves.
+//
+// Updating to a new layout keeps every block that lies wholly within the
+// placements it shares with the old one at either end, so an edit rebuilds
+// the blocks it touches and the small tree over blocks, not the document.
+// ==========================================================================
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "bezier.h"
+#include "glyphs.h"
+#include "layout.h"
+#include "loader.h"
+
+// Binary tree of axis-aligned boxes (x min, y min, x max, y max) over
+// items numbered from 0. Built top-down, splitting each node's items at
+// the median centroid of its longer side.
+class BoxTree {
+  struct Node {
+    float box[4];
+    uint32_t first;   // leaves: first of items; inner nodes: left child, right after it
+    uint32_t count;   // items in a leaf, 0 for inner nodes
+  };
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> items;   // item numbers, grouped by leaf
+
+  static const uint32_t LEAF_ITEMS = 4;
+
+  void build(uint32_t node, uint32_t first, uint32_t count, const float *boxes) {
+    float bound[4] = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+    float centres[4] = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+    for (uint32_t i = first; i < first + count; i++) {
+      const float *b = boxes + 4 * items[i];
+      bound[0] = std::min(bound[0], b[0]);
+      bound[1] = std::min(bound[1], b[1]);
+      bound[2] = std::max(bound[2], b[2]);
+      bound[3] = std::max(bound[3], b[3]);
+      float cx = b[0] + b[2], cy = b[1] + b[3];
+      centres[0] = std::min(centres[0], cx);
+      centres[1] = std::min(centres[1], cy);
+      centres[2] = std::max(centres[2], cx);
+      centres[3] = std::max(centres[3], cy);
+    }
+    std::copy(bound, bound + 4, nodes[node].box);
+    if (count <= LEAF_ITEMS) {
+      nodes[node].first = first;
+      nodes[node].count = count;
+      return;
+    }
+
+    int axis = centres[2] - centres[0] >= centres[3] - centres[1] ? 0 : 1;
+    uint32_t half = count / 2;
+    std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+                     [boxes, axis](uint32_t a, uint32_t b) {
+                       return boxes[4 * a + axis] + boxes[4 * a + axis + 2] <
+                              boxes[4 * b + axis] + boxes[4 * b + axis + 2];
+                     });
+    uint32_t left = nodes.size();
+    nodes.resize(nodes.size() + 2);
+    nodes[node].first = left;
+    nodes[node].count = 0;
+    build(left, first, half, boxes);
+    build(left + 1, first + half, count - half, boxes);
+  }
+
+public:
+  // boxes holds 4 floats per item.
+  void build(const float *boxes, size_t count) {
+    nodes.clear();
+    items.resize(count);
+    for (size_t i = 0; i < count; i++) items[i] = i;
+    if (count == 0) return;
+    nodes.reserve(2 * (count / LEAF_ITEMS) + 1);
+    nodes.resize(1);
+    build(0, 0, count, boxes);
+  }
+
+  bool empty() const { return nodes.empty(); }
+  const float *bounds() const { return nodes[0].box; }
+  size_t memory() const { return nodes.capacity() * sizeof(Node) + items.capacity() * sizeof(uint32_t); }
+
+  // Calls visit(item) for every item whose box may meet query: all those in
+  // leaves whose box does, so visit still tests the item itself.
+  template <typename Visit>
+  void query(const float query[4], Visit visit) const {
+    if (nodes.empty()) return;
+    uint32_t stack[64];
+    int depth = 0;
+    stack[depth++] = 0;
+    while (depth > 0) {
+      const Node &n = nodes[stack[--depth]];
+      if (n.box[0] > query[2] || n.box[2] < query[0] || n.box[1] > query[3] || n.box[3] < query[1]) continue;
+      if (n.count) {
+        for (uint32_t i = n.first; i < n.first + n.count; i++) visit(items[i]);
+      } else {
+        stack[depth++] = n.first;
+        stack[depth++] = n.first + 1;
+      }
+    }
+  }
+};
+
+// Distance from (x, y) to the convex hull of a patch's 4 control points;
+// 0 inside. The hull is the union of the triangles on any 3 of the points,
+// and outside it the nearest point lies on one of the 6 segments between
+// them.
+inline float hullDistance(const float *patch, float x, float y) {
+  static const int triangles[4][3] = { { 0, 1, 2 }, { 0, 1, 3 }, { 0, 2, 3 }, { 1, 2, 3 } };
+  for (const int *t : triangles) {
+    const float *a = patch + 2 * t[0], *b = patch + 2 * t[1], *c = patch + 2 * t[2];
+    float d0 = (b[0] - a[0]) * (y - a[1]) - (b[1] - a[1]) * (x - a[0]);
+    float d1 = (c[0] - b[0]) * (y - b[1]) - (c[1] - b[1]) * (x - b[0]);
+    float d2 = (a[0] - c[0]) * (y - c[1]) - (a[1] - c[1]) * (x - c[0]);
+    if (d0 + d1 + d2 == 0.0f) continue;   // flat, so the segments cover it
+    if ((d0 >= 0 && d1 >= 0 && d2 >= 0) || (d0 <= 0 && d1 <= 0 && d2 <= 0)) return 0.0f;
+  }
+  float best = INFINITY;
+  for (int i = 0; i < 4; i++) {
+    for (int j = i + 1; j < 4; j++) {
+      const float *a = patch + 2 * i, *b = patch + 2 * j;
+      float dx = b[0] - a[0], dy = b[1] - a[1];
+      float length2 = dx * dx + dy * dy;
+      float t = length2 > 0.0f ? ((x - a[0]) * dx + (y - a[1]) * dy) / length2 : 0.0f;
+      t = std::min(std::max(t, 0.0f), 1.0f);
+      best = std::min(best, std::hypot(a[0] + t * dx - x, a[1] + t * dy - y));
+    }
+  }
+  return best;
+}
+
+class GlyphBVH {
+  // A glyph's patches in glyph space, with their hull boxes.
+  struct Shape {
+    std::vector<float> patches;
+    std::vector<float> boxes;
+    BoxTree tree;
+    float box[4];   // of all the hulls; a point at the pen without an outline
+  };
+  struct Block {
+    size_t first;     // placements
+    size_t count;
+    BoxTree tree;     // over the block's glyphs, numbered from first
+    float shift[2];   // since the tree was built
+    float slack;      // how far glyphs may stray from tree + shift
+  };
+
+  GlyphCache *glyphs;
+  std::unordered_map<int, Shape> shapes;   // by code point
+  Shape none;
+  std::vector<GlyphPlacement> placed;
+  std::vector<Block> blocks;
+  BoxTree top;                             // over blocks
+  std::vector<float> boxes;                // scratch
+  std::vector<float> strays;               // by placement from the end, in update()
+  std::vector<Block> kept;                 // the next blocks, in update()
+  std::vector<Block> spare;                // rebuilt blocks, whose trees keep their storage
+
+  const Shape &shape(int code) {
+    auto found = shapes.find(code);
+    if (found != shapes.end()) return found->second;
+    OutlineView outline = glyphs->get(code);
+    // Not cached until a preload has published it
+    if (!glyphs->ready(code)) return none;
+    Shape &s = shapes[code];
+    Loader::appendPatches(outline, 0.0f, 0.0f, s.patches);
+    float bound[4] = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+    for (size_t p = 0; p < s.patches.size(); p += PATCH_FLOATS) {
+      float b[4] = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+      for (int i = 0; i < PATCH_FLOATS; i += 2) {
+        b[0] = std::min(b[0], s.patches[p + i]);
+        b[1] = std::min(b[1], s.patches[p + i + 1]);
+        b[2] = std::max(b[2], s.patches[p + i]);
+        b[3] = std::max(b[3], s.patches[p + i + 1]);
+      }
+      s.boxes.insert(s.boxes.end(), b, b + 4);
+      bound[0] = std::min(bound[0], b[0]);
+      bound[1] = std::min(bound[1], b[1]);
+      bound[2] = std::max(bound[2], b[2]);
+      bound[3] = std::max(bound[3], b[3]);
+    }
+    if (s.patches.empty()) std::fill(bound, bound + 4, 0.0f);
+    std::copy(bound, bound + 4, s.box);
+    s.tree.build(s.boxes.data(), s.boxes.size() / 4);
+    return s;
+  }
+
+  void glyphBox(const GlyphPlacement &p, float *out) {
+    const float *b = shape(p.code).box;
+    out[0] = b[0] + p.x;
+    out[1] = b[1] + p.y;
+    out[2] = b[2] + p.x;
+    out[3] = b[3] + p.y;
+  }
+
+  void buildBlock(Block &block) {
+    boxes.resize(4 * block.count);
+    for (size_t i = 0; i < block.count; i++) glyphBox(placed[block.first + i], &boxes[4 * i]);
+    block.tree.build(boxes.data(), block.count);
+    block.shift[0] = block.shift[1] = 0.0f;
+    block.slack = 0.0f;
+    blocksBuilt++;
+  }
+
+  // Appends blocks covering placements [first, end).
+  void addBlocks(size_t first, size_t end, std::vector<Block> &out) {
+    for (; first < end; first += BLOCK_GLYPHS) {
+      Block block;
+      if (!spare.empty()) {
+        block = std::move(spare.back());
+        spare.pop_back();
+      }
+      block.first = first;
+      block.count = std::min(end - first, (size_t)BLOCK_GLYPHS);
+      buildBlock(block);
+      out.push_back(std::move(block));
+    }
+  }
+
+  // Block's bounds in layout space, or query in the block's tree's space.
+  static void toLayout(const Block &block, const float *box, float *out) {
+    out[0] = box[0] + block.shift[0] - block.slack;
+    out[1] = box[1] + block.shift[1] - block.slack;
+    out[2] = box[2] + block.shift[0] + block.slack;
+    out[3] = box[3] + block.shift[1] + block.slack;
+  }
+  static void toBlock(const Block &block, const float *query, float *out) {
+    out[0] = query[0] - block.shift[0] - block.slack;
+    out[1] = query[1] - block.shift[1] - block.slack;
+    out[2] = query[2] - block.shift[0] + block.slack;
+    out[3] = query[3] - block.shift[1] + block.slack;
+  }
+
+  void buildTop() {
+    boxes.assign(4 * blocks.size(), 0.0f);
+    for (size_t i = 0; i < blocks.size(); i++) toLayout(blocks[i], blocks[i].tree.bounds(), &boxes[4 * i]);
+    top.build(boxes.data(), blocks.size());
+  }
+
+  static bool same(const GlyphPlacement &a, const GlyphPlacement &b) {
+    return a.code == b.code && a.x == b.x && a.y == b.y;
+  }
+
+public:
+  static const size_t BLOCK_GLYPHS = 256;
+
+  // How far text after an edit may stray from a common offset and still be
+  // moved rather than rebuilt; y positions summed line by line drift by a
+  // few ulps. A block is rebuilt once its slack reaches MAX_SLACK.
+  static constexpr float MOVE_SLACK = 1.0f / 256.0f;
+  static constexpr float MAX_SLACK = 1.0f / 16.0f;
+
+  unsigned long blocksBuilt;   // blocks rebuilt by update(), over its life
+
+  explicit GlyphBVH(GlyphCache &cache) : glyphs(&cache), blocksBuilt(0) {
+    std::fill(none.box, none.box + 4, 0.0f);
+  }
+
+  size_t size() const { return placed.size(); }
+
+  // Forgets everything, for when glyph outlines have changed under it.
+  void clear() {
+    shapes.clear();
+    placed.clear();
+    blocks.clear();
+    spare.clear();
+    top.build(0, 0);
+  }
+  size_t blockCount() const { return blocks.size(); }
+
+  // Bytes held by the glyph and block trees, leaving out the shapes.
+  size_t memory() const {
+    size_t bytes = placed.capacity() * sizeof(GlyphPlacement) + top.memory();
+    for (const Block &block : blocks) bytes += sizeof(Block) + block.tree.memory();
+    for (const Block &block : spare) bytes += sizeof(Block) + block.tree.memory();
+    return bytes;
+  }
+
+  // Indexes layout's placements in place of the last ones. Blocks within
+  // the placements the two share at the start are kept, and so are those
+  // within what they share at the end, where the text may also have moved
+  // as a whole, as it does down a line after a line break.
+  void update(const TextLayout &layout) {
+    const std::vector<GlyphPlacement> &next = layout.glyphs;
+    size_t oldSize = placed.size(), newSize = next.size();
+    size_t prefix = 0, limit = std::min(oldSize, newSize);
+    while (prefix < limit && same(placed[prefix], next[prefix])) prefix++;
+    if (prefix == oldSize && oldSize == newSize) return;
+    float dx = 0.0f, dy = 0.0f;
+    if (limit > prefix && placed.back().code == next.back().code) {
+      dx = next.back().x - placed.back().x;
+      dy = next.back().y - placed.back().y;
+    }
+    size_t suffix = 0;
+    strays.clear();
+    for (; suffix < limit - prefix; suffix++) {
+      const GlyphPlacement &a = placed[oldSize - 1 - suffix], &b = next[newSize - 1 - suffix];
+      float stray = std::max(std::fabs(b.x - a.x - dx), std::fabs(b.y - a.y - dy));
+      if (a.code != b.code || stray > MOVE_SLACK) break;
+      strays.push_back(stray);
+    }
+
+    // Blocks wholly in the common prefix stay put, those wholly in the
+    // common suffix move with it, and the placements between are blocked
+    // afresh
+    kept.clear();
+    kept.reserve(blocks.size() + 2);
+    size_t i = 0;
+    for (; i < blocks.size() && blocks[i].first + blocks[i].count <= prefix; i++) kept.push_back(std::move(blocks[i]));
+    size_t j = i;
+    while (j < blocks.size() && blocks[j].first < oldSize - suffix) j++;
+    // Moved blocks take on how far their glyphs strayed, plus the rounding
+    // of their new shift
+    for (size_t k = j; k < blocks.size(); k++) {
+      Block &block = blocks[k];
+      float stray = *std::max_element(strays.begin() + (oldSize - block.first - block.count),
+                                      strays.begin() + (oldSize - block.first));
+      if (dx == 0.0f && dy == 0.0f && stray == 0.0f) continue;
+      float bound[4];
+      block.shift[0] += dx;
+      block.shift[1] += dy;
+      toLayout(block, block.tree.bounds(), bound);
+      float magnitude = std::max(std::max(std::fabs(bound[0]), std::fabs(bound[1])),
+                                 std::max(std::fabs(bound[2]), std::fabs(bound[3])));
+      block.slack += stray + 2.0f * FLT_EPSILON * magnitude;
+      if (block.slack >= MAX_SLACK) j = k + 1;   // rebuilt with the edit
+    }
+    placed = next;
+    for (size_t k = i; k < j; k++) spare.push_back(std::move(blocks[k]));
+    size_t changedBegin = kept.empty() ? 0 : kept.back().first + kept.back().count;
+    size_t changedEnd = j < blocks.size() ? blocks[j].first + newSize - oldSize : newSize;
+    addBlocks(changedBegin, changedEnd, kept);
+    for (; j < blocks.size(); j++) {
+      blocks[j].first += newSize - oldSize;
+      kept.push_back(std::move(blocks[j]));
+    }
+    blocks.swap(kept);
+    buildTop();
+  }
+
+  // Index of the glyph whose outline passes nearest (x, y), within radius
+  // glyph units, by the hulls of its patches; -1 if there is none.
+  long pick(float x, float y, float radius = 0.0f) {
+    float query[4] = { x - radius, y - radius, x + radius, y + radius };
+    long best = -1;
+    float bestDistance = radius;
+    top.query(query, [&](uint32_t b) {
+      const Block &block = blocks[b];
+      float local[4];
+      toBlock(block, query, local);
+      block.tree.query(local, [&](uint32_t g) {
+        const GlyphPlacement &p = placed[block.first + g];
+        const Shape &s = shape(p.code);
+        float inGlyph[4] = { query[0] - p.x, query[1] - p.y, query[2] - p.x, query[3] - p.y };
+        s.tree.query(inGlyph, [&](uint32_t patch) {
+          float d = hullDistance(&s.patches[patch * PATCH_FLOATS], x - p.x, y - p.y);
+          if (d < bestDistance || (d == bestDistance && best < 0)) {
+            bestDistance = d;
+            best = block.first + g;
+          }
+        });
+      });
+    });
+    return best;
+  }
+
+  // Indices of the glyphs whose bounds meet box (x min, y min, x max,
+  // y max), in text order. out is cleared first.
+  void select(const float box[4], std::vector<size_t> &out) {
+    out.clear();
+    top.query(box, [&](uint32_t b) {
+      const Block &block = blocks[b];
+      float local[4];
+      toBlock(block, box, local);
+      block.tree.query(local, [&](uint32_t g) {
+        const GlyphPlacement &p = placed[block.first + g];
+        if (shape(p.code).patches.empty()) return;
+        float glyph[4];
+        glyphBox(p, glyph);
+        if (glyph[0] <= box[2] && glyph[2] >= box[0] && glyph[1] <= box[3] && glyph[3] >= box[1])
+          out.push_back(block.first + g);
+      });
+    });
+    std::sort(out.begin(), out.end());
+  }
+
+  const GlyphPlacement &placement(size_t i) const { return placed[i]; }
+};
+
+#endif
@@ -0,0 +1,260 @@
+// ==========================================================================
+// Documents: large texts laid out and drawn a chunk at a time
+//
+// The text is split at line boundaries into chunks of at most a few KB
+// (lines longer than that are cut into several). Splitting only counts lines,
+// which gives every chunk a conservative bounding box without laying it out;
+// only the pieces of cut lines are measured, so they can be culled sideways
+// too. A chunk is laid out the first time it intersects the view,
+// its box is then tightened to the ink, and chunks that have left the view
+// are dropped least recently used first once the laid out chunks exceed a
+// memory budget. Work and memory follow what is on screen, not the size of
+// the document.
+// ==========================================================================
+
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "glyphs.h"
+#include "layout.h"
+#include "utf8.h"
+
+struct DocumentChunk {
+  size_t begin;         // bytes of the document
+  size_t end;
+  int firstLine;
+  float firstX;         // pen position; nonzero when the chunk continues a cut line
+  int lines;
+  float box[4];         // x min, y min, x max, y max, in document glyph units
+  bool built;
+  TextLayout layout;    // placements in document glyph units once built
+  unsigned long lastUse;
+};
+
+class Document {
+  std::string text;
+  std::vector<DocumentChunk> chunks;
+  LayoutEngine *layouts;
+  size_t chunkBytes;
+  int lineCount;
+  size_t bytesBuilt;
+  unsigned long frame;
+  std::vector<size_t> shown;        // chunks gathered by the last visible()
+  std::vector<size_t> candidates;
+  std::string chunkText;            // the chunk build() is laying out
+
+  // Glyph ink stays within these of the pen position; only used for chunks
+  // not laid out yet.
+  static constexpr float ASCENT = 1.0f;
+  static constexpr float DESCENT = 0.5f;
+  static constexpr float OVERHANG = 0.5f;
+
+  static bool continuation(char c) { return ((unsigned char)c & 0xC0) == 0x80; }
+
+  float measure(size_t begin, size_t end) {
+    float width = 0.0f;
+    const char *p = text.data() + begin, *stop = text.data() + end;
+    while (p < stop) width += layouts->advance(nextCodePoint(p, stop));
+    return width;
+  }
+
+  void split() {
+    chunks.clear();
+    size_t n = text.size();
+    size_t begin = 0;
+    int line = 0;
+    float x = 0.0f;
+    while (begin < n) {
+      size_t limit = std::min(n, begin + chunkBytes);
+      size_t end = limit;
+      if (limit < n) {
+        while (end > begin && text[end - 1] != '\n') end--;
+        if (end == begin) {
+          // One line longer than a chunk: cut it, but not inside a code point
+          end = limit;
+          while (end > begin + 1 && continuation(text[end])) end--;
+        }
+      }
+
+      DocumentChunk chunk = DocumentChunk();
+      chunk.begin = begin;
+      chunk.end = end;
+      chunk.firstLine = line;
+      chunk.firstX = x;
+      size_t lastLine = begin;
+      for (const char *p = text.data() + begin, *stop = text.data() + end;
+           (p = (const char *)memchr(p, '\n', stop - p)); p++) {
+        line++;
+        lastLine = p + 1 - text.data();
+      }
+      // A trailing newline starts the next chunk's first line
+      chunk.lines = line - chunk.firstLine + (text[end - 1] != '\n');
+
+      // Pieces of a cut line have a known horizontal extent; anything else
+      // may reach as far right as its longest line.
+      bool cut = end < n && text[end - 1] != '\n';
+      bool single = chunk.lines == 1;
+      float lineEnd = 0.0f;
+      if (cut || (single && x > 0.0f)) lineEnd = (lastLine == begin ? x : 0.0f) + measure(lastLine, end);
+      x = cut ? lineEnd : 0.0f;
+
+      float lineHeight = layouts->lineHeight;
+      chunk.box[0] = (single ? chunk.firstX : 0.0f) - OVERHANG;
+      chunk.box[1] = -(chunk.firstLine + chunk.lines - 1) * lineHeight - DESCENT;
+      chunk.box[2] = single && lineEnd > 0.0f ? lineEnd + OVERHANG : INFINITY;
+      chunk.box[3] = -chunk.firstLine * lineHeight + ASCENT;
+      chunks.push_back(chunk);
+      begin = end;
+    }
+    lineCount = line + 1;
+  }
+
+  static size_t footprint(const DocumentChunk &chunk) {
+    return chunk.layout.glyphs.capacity() * sizeof(GlyphPlacement);
+  }
+
+  // Lays the chunk out and moves it to its place in the document. Chunks
+  // are laid out outside the engine's cache, which they would only churn.
+  void build(DocumentChunk &chunk) {
+    chunkText.assign(text, chunk.begin, chunk.end - chunk.begin);
+    layouts->layout(chunkText, 0.0f, chunk.layout);
+    chunk.layout.glyphs.shrink_to_fit();
+
+    GlyphCache &glyphs = layouts->cache();
+    float y = -chunk.firstLine * layouts->lineHeight;
+    float box[4] = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+    for (GlyphPlacement &placement : chunk.layout.glyphs) {
+      // Only the first line continues a cut line
+      if (placement.y == 0.0f) placement.x += chunk.firstX;
+      placement.y += y;
+      GlyphMetrics metrics = glyphs.metrics(placement.code);
+      const float *ink = metrics.bbox;
+      box[0] = std::min(box[0], placement.x + ink[0]);
+      box[1] = std::min(box[1], placement.y + ink[1]);
+      box[2] = std::max(box[2], placement.x + ink[2]);
+      box[3] = std::max(box[3], placement.y + ink[3]);
+    }
+    // Blank chunks keep an empty box that nothing intersects
+    std::copy(box, box + 4, chunk.box);
+    chunk.built = true;
+    bytesBuilt += footprint(chunk);
+    builds++;
+  }
+
+  void release(DocumentChunk &chunk) {
+    bytesBuilt -= footprint(chunk);
+    std::vector<GlyphPlacement>().swap(chunk.layout.glyphs);
+    chunk.built = false;
+    evictions++;
+  }
+
+  // Drops the least recently used chunks outside the view until the laid
+  // out chunks fit the budget.
+  void evict() {
+    if (bytesBuilt <= budget) return;
+    candidates.clear();
+    for (size_t i = 0; i < chunks.size(); i++)
+      if (chunks[i].built && chunks[i].lastUse != frame) candidates.push_back(i);
+    std::sort(candidates.begin(), candidates.end(),
+              [this](size_t a, size_t b) { return chunks[a].lastUse < chunks[b].lastUse; });
+    for (size_t i = 0; i < candidates.size() && bytesBuilt > budget; i++) release(chunks[candidates[i]]);
+  }
+
+public:
+  size_t budget;            // bytes of laid out chunks kept
+  unsigned long builds;
+  unsigned long evictions;
+
+  explicit Document(LayoutEngine &engine, size_t chunkBytes = 4096, size_t budget = 8 << 20)
+    : layouts(&engine), chunkBytes(std::max<size_t>(chunkBytes, 4)), lineCount(0), bytesBuilt(0),
+      frame(0), budget(budget), builds(0), evictions(0) {}
+
+  bool open(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    setText(contents.str());
+    return true;
+  }
+
+  void setText(const std::string &newText) {
+    text = newText;
+    relayout();
+  }
+
+  // Drops every laid out chunk and splits the text again, for when glyph
+  // metrics have changed under it.
+  void relayout() {
+    bytesBuilt = 0;
+    shown.clear();
+    split();
+  }
+
+  size_t size() const { return text.size(); }
+  int lines() const { return lineCount; }
+  size_t chunkCount() const { return chunks.size(); }
+  size_t builtCount() const {
+    return std::count_if(chunks.begin(), chunks.end(), [](const DocumentChunk &c) { return c.built; });
+  }
+  size_t memory() const { return bytesBuilt; }
+  const std::vector<size_t> &visibleChunks() const { return shown; }
+
+  // Gathers the placements of the chunks intersecting view (x min, y min,
+  // x max, y max in document glyph units) into out, laying out the ones
+  // seen for the first time. Returns false, leaving out alone, when the
+  // same chunks were visible last time.
+  bool visible(const float view[4], TextLayout &out) {
+    frame++;
+    float lineHeight = layouts->lineHeight;
+    int top = (int)std::floor((-view[3] - DESCENT) / lineHeight);
+    int bottom = (int)std::ceil((-view[1] + ASCENT) / lineHeight);
+
+    // Chunks are in line order, so the first candidate is a binary search
+    // away and the scan stops below the view.
+    auto first = std::lower_bound(chunks.begin(), chunks.end(), top,
+                                  [](const DocumentChunk &c, int line) { return c.firstLine + c.lines <= line; });
+    candidates.clear();
+    for (auto it = first; it != chunks.end() && it->firstLine <= bottom; ++it) {
+      DocumentChunk &chunk = *it;
+      bool overlaps = chunk.box[0] <= view[2] && chunk.box[2] >= view[0] &&
+                      chunk.box[1] <= view[3] && chunk.box[3] >= view[1];
+      if (!overlaps) continue;
+      if (!chunk.built) {
+        build(chunk);
+        overlaps = chunk.box[0] <= view[2] && chunk.box[2] >= view[0] &&
+                   chunk.box[1] <= view[3] && chunk.box[3] >= view[1];
+      }
+      chunk.lastUse = frame;
+      if (overlaps) candidates.push_back(it - chunks.begin());
+    }
+
+    bool changed = candidates != shown;
+    if (changed) {
+      shown = candidates;
+      out.glyphs.clear();
+      out.lines = 0;
+      out.longestLine = 0;
+      out.width = 0.0f;
+      for (size_t i : shown) {
+        const TextLayout &layout = chunks[i].layout;
+        out.glyphs.insert(out.glyphs.end(), layout.glyphs.begin(), layout.glyphs.end());
+        out.lines += layout.lines;
+        out.longestLine = std::max(out.longestLine, layout.longestLine);
+        out.width = std::max(out.width, layout.width);
+      }
+    }
+    evict();
+    return changed;
+  }
+};
+
+#endif
@@ -0,0 +1,284 @@
+// ==========================================================================
+// Filled glyph triangulation
+//
+// A glyph's contours are flattened once in glyph space and swept from the
+// bottom up: the edges are split into horizontal bands at every
+// vertex and at every crossing of two edges, so within a band they neither
+// end nor cross, and each band is filled between the edges where the
+// non-zero winding count turns on and off. Holes such as the counters of
+// 'o' and 'e' fall out of the winding, whichever way the contours run.
+// A filled span that carries on unbroken through the next bands grows into
+// a y-monotone polygon, which is triangulated in one pass at about one
+// triangle per vertex.
+//
+// The result depends only on the outline, so it is computed once per glyph
+// and drawn as plain triangles (see GlyphGeometry).
+// ==========================================================================
+
+#ifndef FILL_H
+#define FILL_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "bezier.h"
+#include "glyphs.h"
+
+// Flattening tolerance of filled glyphs, in glyph units. Fills are built
+// once for every zoom, so this is fine enough to stay under a quarter pixel
+// until a glyph unit spans 256 pixels.
+const float FILL_TOLERANCE = 1.0f / 1024.0f;
+
+// Straight edge of a flattened outline, in glyph space.
+struct FillEdge {
+  float x0, y0, x1, y1;
+
+  // Exact at the endpoints, so edges meeting at a vertex agree there.
+  float xAt(float y) const {
+    if (y == y0) return x0;
+    if (y == y1) return x1;
+    return x0 + (y - y0) * (x1 - x0) / (y1 - y0);
+  }
+};
+
+// Appends the edges of outline, flattened to within tolerance. Horizontal
+// edges are kept; they carry no winding and the sweep skips them.
+inline void outlineEdges(const OutlineView &outline, float tolerance, std::vector<FillEdge> &edges) {
+  const float *c = outline.coords;
+  float start[2] = {}, pen[2] = {};
+  for (size_t i = 0; i < outline.commandCount; i++) {
+    char command = outline.commands[i];
+    if (command == 'M') {
+      pen[0] = start[0] = c[0];
+      pen[1] = start[1] = c[1];
+      c += 2;
+    } else if (command == 'C') {
+      float p[8] = { pen[0], pen[1], c[0], c[1], c[2], c[3], c[4], c[5] };
+      int n = flattenSegments(p, tolerance, 64);
+      for (int k = 1; k <= n; k++) {
+        FillEdge e = { pen[0], pen[1], 0.0f, 0.0f };
+        if (k == n) {
+          e.x1 = p[6];
+          e.y1 = p[7];
+        } else {
+          bezierPoint(p, (float)k / n, e.x1, e.y1);
+        }
+        edges.push_back(e);
+        pen[0] = e.x1;
+        pen[1] = e.y1;
+      }
+      c += 6;
+    } else {
+      const float *to = command == 'Z' ? start : c;
+      if (to[0] != pen[0] || to[1] != pen[1]) {
+        FillEdge e = { pen[0], pen[1], to[0], to[1] };
+        edges.push_back(e);
+      }
+      pen[0] = to[0];
+      pen[1] = to[1];
+      if (command == 'L') c += 2;
+    }
+  }
+}
+
+// Non-zero winding number of the edges around (x, y), from the crossings
+// of a ray to -x. The reference the triangulation is checked against.
+inline int windingNumber(const std::vector<FillEdge> &edges, float x, float y) {
+  int winding = 0;
+  for (const FillEdge &e : edges) {
+    if ((e.y0 <= y) == (e.y1 <= y)) continue;
+    if (e.xAt(y) < x) winding += e.y1 > e.y0 ? 1 : -1;
+  }
+  return winding;
+}
+
+class FillTriangulator {
+  struct Crossing {
+    float bottom, top;   // x where the edge meets the band's bottom and top
+    float middle;
+    int edge;
+    int direction;       // +1 upwards
+  };
+  struct Point {
+    float x, y;
+    bool right;          // on the right chain
+  };
+  // A filled span that carries on band after band while its two sides
+  // continue without a break: a y-monotone polygon, collected as its
+  // vertices in order of height.
+  struct Span {
+    int left, right;     // current edges
+    float left0, right0; // where they cross the bottom of the current band
+    std::vector<Point> points;
+    bool continued;
+  };
+
+  std::vector<float> ys;
+  std::vector<Crossing> crossings;
+  std::vector<Span> open, next;
+  std::vector<float> pending;   // band tops still to sweep, highest first
+  std::vector<size_t> stack;
+
+  // Whether the diagonal from point to below, passing by last, stays inside
+  // the polygon: last must bulge outwards from its chain.
+  static bool visible(const Point &point, const Point &last, const Point &below) {
+    float cross = (point.x - below.x) * (last.y - below.y) - (point.y - below.y) * (last.x - below.x);
+    return point.right ? cross < 0.0f : cross > 0.0f;
+  }
+
+  static void triangle(const Point &a, const Point &b, const Point &c, std::vector<float> &triangles) {
+    triangles.insert(triangles.end(), { a.x, a.y, b.x, b.y, c.x, c.y });
+  }
+
+  // Triangulates a y-monotone polygon from its vertices, lowest first: each
+  // vertex either closes a fan to the other chain or cuts off what it can
+  // see of its own.
+  void monotone(const std::vector<Point> &u, std::vector<float> &triangles) {
+    if (u.size() < 3) return;
+    stack.assign({ 0, 1 });
+    for (size_t j = 2; j + 1 < u.size(); j++) {
+      if (u[j].right != u[stack.back()].right) {
+        for (size_t k = stack.size() - 1; k > 0; k--) triangle(u[j], u[stack[k]], u[stack[k - 1]], triangles);
+        stack.assign({ j - 1, j });
+      } else {
+        size_t last = stack.back();
+        stack.pop_back();
+        while (!stack.empty() && visible(u[j], u[last], u[stack.back()])) {
+          triangle(u[j], u[last], u[stack.back()], triangles);
+          last = stack.back();
+          stack.pop_back();
+        }
+        stack.push_back(last);
+        stack.push_back(j);
+      }
+    }
+    const Point &top = u.back();
+    for (size_t k = stack.size() - 1; k > 0; k--) triangle(top, u[stack[k]], u[stack[k - 1]], triangles);
+  }
+
+  void close(const std::vector<FillEdge> &edges, Span &span, float y, std::vector<float> &triangles) {
+    Point left = { edges[span.left].xAt(y), y, false }, right = { edges[span.right].xAt(y), y, true };
+    span.points.push_back(left);
+    if (right.x != left.x) span.points.push_back(right);
+    monotone(span.points, triangles);
+  }
+
+  // Starts the band at y0 from its crossings. A span carries on from the
+  // band below when it overlaps just one span there, which overlaps just
+  // it, and their sides meet; the rest are closed and new ones opened.
+  void band(const std::vector<FillEdge> &edges, float y0, std::vector<float> &triangles) {
+    next.clear();
+    int winding = 0;
+    Span span = { -1, -1, 0.0f, 0.0f, std::vector<Point>(), false };
+    for (const Crossing &c : crossings) {
+      int before = winding;
+      winding += c.direction;
+      if (before == 0) {
+        span.left = c.edge;
+        span.left0 = c.bottom;
+      } else if (winding == 0) {
+        span.right = c.edge;
+        span.right0 = c.bottom;
+        next.push_back(span);
+      }
+    }
+
+    for (Span &s : next) {
+      Span *match = 0;
+      int overlaps = 0;
+      for (Span &o : open) {
+        float left = edges[o.left].xAt(y0), right = edges[o.right].xAt(y0);
+        if (std::max(left, s.left0) >= std::min(right, s.right0)) continue;
+        overlaps++;
+        match = &o;
+      }
+      if (overlaps == 1 && !match->continued) {
+        int matchOverlaps = 0;
+        float left = edges[match->left].xAt(y0), right = edges[match->right].xAt(y0);
+        for (const Span &n : next)
+          if (std::max(left, n.left0) < std::min(right, n.right0)) matchOverlaps++;
+        if (matchOverlaps == 1 && left == s.left0 && right == s.right0) {
+          match->continued = true;
+          s.points.swap(match->points);
+          Point l = { s.left0, y0, false }, r = { s.right0, y0, true };
+          if (s.left != match->left) s.points.push_back(l);
+          if (s.right != match->right) s.points.push_back(r);
+          continue;
+        }
+      }
+      Point l = { s.left0, y0, false }, r = { s.right0, y0, true };
+      s.points.push_back(l);
+      if (r.x != l.x) s.points.push_back(r);
+    }
+    for (Span &o : open)
+      if (!o.continued) close(edges, o, y0, triangles);
+    open.swap(next);
+  }
+
+public:
+  // Appends the triangles covering the non-zero winding interior of edges
+  // to triangles, as x/y pairs.
+  void triangulate(const std::vector<FillEdge> &edges, std::vector<float> &triangles) {
+    ys.clear();
+    for (const FillEdge &e : edges) {
+      if (e.y0 == e.y1) continue;
+      ys.push_back(e.y0);
+      ys.push_back(e.y1);
+    }
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+    open.clear();
+
+    for (size_t i = 0; i + 1 < ys.size(); i++) {
+      float y0 = ys[i];
+      pending.assign(1, ys[i + 1]);
+      while (!pending.empty()) {
+        float y1 = pending.back();
+        float middle = 0.5f * (y0 + y1);
+        crossings.clear();
+        for (size_t k = 0; k < edges.size(); k++) {
+          const FillEdge &e = edges[k];
+          if (std::min(e.y0, e.y1) > y0 || std::max(e.y0, e.y1) < y1 || e.y0 == e.y1) continue;
+          Crossing c = { e.xAt(y0), e.xAt(y1), e.xAt(middle), (int)k, e.y1 > e.y0 ? 1 : -1 };
+          crossings.push_back(c);
+        }
+        std::sort(crossings.begin(), crossings.end(),
+                  [](const Crossing &a, const Crossing &b) { return a.middle < b.middle; });
+
+        // Two edges swapping places cross inside the band: sweep up to
+        // the crossing first
+        float split = y1;
+        for (size_t k = 0; k + 1 < crossings.size(); k++) {
+          const Crossing &a = crossings[k], &b = crossings[k + 1];
+          float bottom = b.bottom - a.bottom, top = b.top - a.top;
+          if (bottom >= -1e-6f && top >= -1e-6f) continue;
+          float t = bottom / (bottom - top);
+          float y = y0 + (y1 - y0) * t;
+          if (y > y0 && y < split) split = y;
+        }
+        if (split < y1 && split > y0) {
+          pending.push_back(split);
+          continue;
+        }
+
+        band(edges, y0, triangles);
+        y0 = y1;
+        pending.pop_back();
+      }
+    }
+    if (!ys.empty())
+      for (Span &o : open) close(edges, o, ys.back(), triangles);
+    open.clear();
+  }
+};
+
+// Triangles filling outline, as x/y pairs in glyph space.
+inline void triangulateOutline(const OutlineView &outline, std::vector<float> &triangles,
+                               float tolerance = FILL_TOLERANCE) {
+  std::vector<FillEdge> edges;
+  outlineEdges(outline, tolerance, edges);
+  FillTriangulator().triangulate(edges, triangles);
+}
+
+#endif
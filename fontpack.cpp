@@ -0,0 +1,220 @@
+// ==========================================================================
+// fontpack: compiles a glyph directory into a packed binary font file
+//
+// Usage:  fontpack [directory] [output]      (defaults: cmuntt/ cmuntt.pack)
+//         fontpack -t [directory] [pack]     time loading every glyph from
+//                                            the text files and the pack
+//         fontpack -header [directory] [output] [ranges]
+//                                            write a header of constexpr
+//                                            arrays (default embeddedfont.h)
+//
+// ranges limits the header to some code points, as in "32-126,160-255"; the
+// fallback glyph is always included.
+// ==========================================================================
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "glyphs.h"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+int writePack(const string &directory, const string &output) {
+  vector<int> codes = listGlyphCodes(directory);
+  std::sort(codes.begin(), codes.end());
+  if (codes.empty()) {
+    cerr << "No glyph files found in " << directory << endl;
+    return 1;
+  }
+
+  vector<PackEntry> entries;
+  vector<char> commands;
+  vector<float> coords;
+  Outline outline;
+  OutlineParser parser;
+
+  for (int code : codes) {
+    string path = directory + "gly_" + std::to_string(code);
+    if (!parser.read(path, outline)) {
+      cerr << "Impossible to open the file, " << path << endl;
+      return 1;
+    }
+
+    PackEntry entry = {};
+    entry.code = code;
+    entry.firstCommand = commands.size();
+    entry.commandCount = outline.commands.size();
+    entry.firstCoord = coords.size();
+    entry.coordCount = outline.coords.size();
+    if (!outline.coords.empty()) {
+      entry.bbox[0] = entry.bbox[2] = outline.coords[0];
+      entry.bbox[1] = entry.bbox[3] = outline.coords[1];
+    }
+    for (size_t i = 0; i + 1 < outline.coords.size(); i += 2) {
+      entry.bbox[0] = std::min(entry.bbox[0], outline.coords[i]);
+      entry.bbox[1] = std::min(entry.bbox[1], outline.coords[i + 1]);
+      entry.bbox[2] = std::max(entry.bbox[2], outline.coords[i]);
+      entry.bbox[3] = std::max(entry.bbox[3], outline.coords[i + 1]);
+    }
+    entries.push_back(entry);
+
+    commands.insert(commands.end(), outline.commands.begin(), outline.commands.end());
+    coords.insert(coords.end(), outline.coords.begin(), outline.coords.end());
+  }
+
+  PackHeader header = {};
+  header.magic = FONTPACK_MAGIC;
+  header.version = FONTPACK_VERSION;
+  header.glyphCount = entries.size();
+  header.commandsOffset = sizeof(PackHeader) + entries.size() * sizeof(PackEntry);
+  header.commandCount = commands.size();
+  header.coordsOffset = (header.commandsOffset + commands.size() + 3) & ~3u;
+  header.coordCount = coords.size();
+
+  FILE *file = fopen(output.c_str(), "wb");
+  if (file == NULL) {
+    cerr << "Impossible to open the file, " << output << endl;
+    return 1;
+  }
+  char padding[4] = {};
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(entries.data(), sizeof(PackEntry), entries.size(), file);
+  fwrite(commands.data(), 1, commands.size(), file);
+  fwrite(padding, 1, header.coordsOffset - header.commandsOffset - commands.size(), file);
+  fwrite(coords.data(), sizeof(float), coords.size(), file);
+  bool ok = ferror(file) == 0;
+  fclose(file);
+  if (!ok) {
+    cerr << "Failed writing " << output << endl;
+    return 1;
+  }
+
+  cout << output << ": " << entries.size() << " glyphs, " << commands.size()
+       << " records, " << header.coordsOffset + coords.size() * sizeof(float)
+       << " bytes" << endl;
+  return 0;
+}
+
+// Shortest decimal that reads back as v, as a float literal.
+string floatLiteral(float v) {
+  char text[32];
+  for (int precision = 1; precision < 10; precision++) {
+    snprintf(text, sizeof(text), "%.*g", precision, v);
+    if (strtof(text, 0) == v) break;
+  }
+  string literal = text;
+  if (literal.find_first_of(".e") == string::npos) literal += ".0";
+  return literal + "f";
+}
+
+// Writes the glyphs of directory in ranges as an EmbeddedFont named
+// EMBEDDED_FONT, for builds with EMBED_FONT.
+int writeHeader(const string &directory, const string &output, const string &ranges) {
+  vector<int> codes = listGlyphCodes(directory);
+  std::sort(codes.begin(), codes.end());
+  codes.erase(std::remove_if(codes.begin(), codes.end(), [&ranges](int code) {
+                return code != GlyphCache::FALLBACK_CODE && !inCodeRanges(code, ranges);
+              }), codes.end());
+  if (codes.empty()) {
+    cerr << "No glyph files found in " << directory << endl;
+    return 1;
+  }
+
+  GlyphCache glyphs(directory, "");
+  string table, commands, coords;
+  size_t commandCount = 0, coordCount = 0;
+  char line[256];
+  for (int code : codes) {
+    OutlineView outline = glyphs.get(code);
+    GlyphMetrics m = glyphs.metrics(code);
+    snprintf(line, sizeof(line), "  { %d, %zu, %zu, %zu, %zu, { { ", code, commandCount, outline.commandCount,
+             coordCount, outline.coordCount);
+    table += line;
+    for (int i = 0; i < 4; i++) table += floatLiteral(m.bbox[i]) + (i < 3 ? ", " : " }, ");
+    table += floatLiteral(m.advance) + ", " + floatLiteral(m.leftBearing) + ", " +
+             floatLiteral(m.rightBearing) + " } },\n";
+
+    commands.append(outline.commands, outline.commandCount);
+    commands += "\"\n  \"";
+    for (size_t i = 0; i < outline.coordCount; i++)
+      coords += (i % 8 ? " " : "\n  ") + floatLiteral(outline.coords[i]) + ",";
+    commandCount += outline.commandCount;
+    coordCount += outline.coordCount;
+  }
+  if (coordCount == 0) coords = "\n  0.0f";
+
+  FILE *file = fopen(output.c_str(), "w");
+  if (file == NULL) {
+    cerr << "Impossible to open the file, " << output << endl;
+    return 1;
+  }
+  fprintf(file, "// Generated by fontpack -header from %s; do not edit.\n\n", directory.c_str());
+  fprintf(file, "#ifndef EMBEDDEDFONT_H\n#define EMBEDDEDFONT_H\n\n#include \"glyphs.h\"\n\n");
+  fprintf(file, "constexpr EmbeddedGlyph EMBEDDED_GLYPHS[] = {\n%s};\n\n", table.c_str());
+  fprintf(file, "constexpr char EMBEDDED_COMMANDS[] =\n  \"%s\";\n\n", commands.c_str());
+  fprintf(file, "constexpr float EMBEDDED_COORDS[] = {%s\n};\n\n", coords.c_str());
+  fprintf(file, "constexpr EmbeddedFont EMBEDDED_FONT = { EMBEDDED_GLYPHS, %zu, EMBEDDED_COMMANDS, EMBEDDED_COORDS };\n",
+          codes.size());
+  fprintf(file, "\n#endif\n");
+  bool ok = ferror(file) == 0;
+  fclose(file);
+  if (!ok) {
+    cerr << "Failed writing " << output << endl;
+    return 1;
+  }
+
+  cout << output << ": " << codes.size() << " glyphs, " << commandCount << " records, "
+       << coordCount * sizeof(float) << " bytes of coordinates" << endl;
+  return 0;
+}
+
+// Loads every glyph through a fresh cache and returns the elapsed time in ms.
+double timeLoad(const string &directory, const string &pack, const vector<int> &codes,
+                bool &usedPack) {
+  auto start = std::chrono::steady_clock::now();
+  GlyphCache glyphs(directory, pack);
+  size_t records = 0;
+  for (int code : codes) records += glyphs.get(code).commandCount;
+  auto end = std::chrono::steady_clock::now();
+  usedPack = glyphs.usingPack();
+  if (records == 0) cerr << "No glyph data loaded" << endl;
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int timePaths(const string &directory, const string &pack) {
+  vector<int> codes = listGlyphCodes(directory);
+  bool usedPack;
+
+  double text = timeLoad(directory, "", codes, usedPack);
+  double packed = timeLoad(directory, pack, codes, usedPack);
+  if (!usedPack) {
+    cerr << "Impossible to open the pack, " << pack << endl;
+    return 1;
+  }
+
+  cout << codes.size() << " glyphs" << endl;
+  cout << "  text files: " << text << " ms" << endl;
+  cout << "  pack:       " << packed << " ms" << endl;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  bool timing = argc > 1 && string(argv[1]) == "-t";
+  bool header = argc > 1 && string(argv[1]) == "-header";
+  int first = timing || header ? 2 : 1;
+  string directory = argc > first ? argv[first] : "cmuntt/";
+  string output = argc > first + 1 ? argv[first + 1] : header ? "embeddedfont.h" : "cmuntt.pack";
+  if (directory.back() != '/') directory += '/';
+
+  if (header) return writeHeader(directory, output, argc > first + 2 ? argv[first + 2] : "");
+  return timing ? timePaths(directory, output) : writePack(directory, output);
+}
@@ -0,0 +1,167 @@
+// ==========================================================================
+// Packed binary font file
+//
+// fontpack.cpp compiles the cmuntt/ directory into a single file that is
+// mmap'ed at startup and read in place, with no parsing and no copies:
+//
+//   PackHeader
+//   PackEntry[glyphCount]      sorted by code point
+//   char  commands[]           'M', 'C', 'L', 'Z' for every glyph
+//   float coords[]             x/y pairs, 4-byte aligned
+//
+// Entries index into the two shared arrays. All values are native endian;
+// the header magic doubles as a byte order check. Opening a pack never
+// looks at the glyph files: the Makefile rebuilds it when any of them
+// changes.
+// ==========================================================================
+
+#ifndef FONTPACK_H
+#define FONTPACK_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const uint32_t FONTPACK_MAGIC = 0x314b5047;  // "GPK1"
+const uint32_t FONTPACK_VERSION = 1;
+
+struct PackHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t glyphCount;
+  uint32_t commandsOffset;   // byte offset of the command array
+  uint32_t commandCount;
+  uint32_t coordsOffset;     // byte offset of the coordinate array
+  uint32_t coordCount;
+  uint32_t reserved;
+};
+
+struct PackEntry {
+  int32_t code;
+  uint32_t firstCommand;
+  uint32_t commandCount;
+  uint32_t firstCoord;
+  uint32_t coordCount;
+  float bbox[4];             // min x, min y, max x, max y of control points
+};
+
+// Coordinates an outline's commands read: 2 for M and L, 6 for C, none for
+// Z. -1 if a command is none of those.
+inline long outlineCoordCount(const char *commands, size_t count) {
+  long coords = 0;
+  for (size_t i = 0; i < count; i++) {
+    char c = commands[i];
+    if (c == 'M' || c == 'L') coords += 2;
+    else if (c == 'C') coords += 6;
+    else if (c != 'Z') return -1;
+  }
+  return coords;
+}
+
+// Read-only mapping of a pack file.
+class FontPack {
+  void *data;
+  size_t size;
+  const PackHeader *header;
+  const PackEntry *entries;
+  const char *commands;
+  const float *coords;
+
+public:
+  FontPack() {
+    data = 0;
+    size = 0;
+    header = 0;
+    entries = 0;
+    commands = 0;
+    coords = 0;
+  }
+  FontPack(const FontPack &) = delete;
+  FontPack &operator=(const FontPack &) = delete;
+
+  // Maps path. Returns false, leaving the pack closed, if the file is missing
+  // or is not a pack this build can read: every entry is checked against
+  // the arrays once here, so get() can trust them.
+  bool open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PackHeader)) {
+      ::close(fd);
+      return false;
+    }
+    size = st.st_size;
+    data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      data = 0;
+      return false;
+    }
+
+    const char *bytes = (const char *)data;
+    header = (const PackHeader *)bytes;
+    // In size_t, so no sum of 32-bit fields wraps
+    if (header->magic != FONTPACK_MAGIC || header->version != FONTPACK_VERSION ||
+        sizeof(PackHeader) + (size_t)header->glyphCount * sizeof(PackEntry) > size ||
+        (size_t)header->commandsOffset + header->commandCount > size ||
+        header->coordsOffset % sizeof(float) != 0 ||
+        (size_t)header->coordsOffset + (size_t)header->coordCount * sizeof(float) > size) {
+      close();
+      return false;
+    }
+    entries = (const PackEntry *)(bytes + sizeof(PackHeader));
+    commands = bytes + header->commandsOffset;
+    coords = (const float *)(bytes + header->coordsOffset);
+    for (size_t i = 0; i < header->glyphCount; i++) {
+      const PackEntry &e = entries[i];
+      if ((i > 0 && entries[i - 1].code >= e.code) ||
+          (size_t)e.firstCommand + e.commandCount > header->commandCount ||
+          (size_t)e.firstCoord + e.coordCount > header->coordCount ||
+          outlineCoordCount(commands + e.firstCommand, e.commandCount) != (long)e.coordCount) {
+        close();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void close() {
+    if (data) munmap(data, size);
+    data = 0;
+    size = 0;
+    header = 0;
+  }
+
+  bool isOpen() const { return header != 0; }
+
+  size_t glyphCount() const { return header ? header->glyphCount : 0; }
+
+  const PackEntry *begin() const { return entries; }
+  const PackEntry *end() const { return entries + glyphCount(); }
+
+  const PackEntry *find(int code) const {
+    if (!header) return 0;
+    const PackEntry *e = std::lower_bound(begin(), end(), code,
+      [](const PackEntry &entry, int c) { return entry.code < c; });
+    return (e != end() && e->code == code) ? e : 0;
+  }
+
+  const char *commandsOf(const PackEntry &entry) const {
+    return commands + entry.firstCommand;
+  }
+  const float *coordsOf(const PackEntry &entry) const {
+    return coords + entry.firstCoord;
+  }
+
+  ~FontPack() { close(); }
+};
+
+#endif
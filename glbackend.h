@@ -0,0 +1,370 @@
+// ==========================================================================
+// GL backend interface
+//
+// Program, VertexArray and render() issue their GL calls through a
+// GLBackend instead of calling OpenGL directly. The interface mirrors the
+// GL entry points it wraps, minus the gl prefix. OpenGLBackend (in
+// boilerplate.cpp) forwards to the driver; RecordingBackend below needs no
+// GPU and only keeps count, so buffer churn can be measured headless.
+// ==========================================================================
+
+#ifndef GLBACKEND_H
+#define GLBACKEND_H
+
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#else
+#include <GL/glcorearb.h>
+#endif
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+class GLBackend {
+public:
+  virtual ~GLBackend() {}
+
+  virtual GLuint createProgram() = 0;
+  virtual void deleteProgram(GLuint program) = 0;
+  virtual void attachShader(GLuint program, GLuint shader) = 0;
+  virtual void linkProgram(GLuint program) = 0;
+  virtual GLint getProgramiv(GLuint program, GLenum pname) = 0;
+  virtual std::string getProgramInfoLog(GLuint program) = 0;
+  virtual void programParameteri(GLuint program, GLenum pname, GLint value) = 0;
+  // Resizes binary to the program's binary and fills it in.
+  virtual void getProgramBinary(GLuint program, std::vector<char> &binary, GLenum &format) = 0;
+  virtual void programBinary(GLuint program, GLenum format, const void *binary, GLsizei length) = 0;
+  virtual void useProgram(GLuint program) = 0;
+  virtual GLint getUniformLocation(GLuint program, const char *name) = 0;
+  virtual void uniform1f(GLint location, GLfloat v0) = 0;
+  virtual void uniform1i(GLint location, GLint v0) = 0;
+  virtual void uniform2f(GLint location, GLfloat v0, GLfloat v1) = 0;
+  virtual void uniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) = 0;
+
+  virtual GLuint createShader(GLenum type) = 0;
+  virtual void deleteShader(GLuint shader) = 0;
+  virtual void shaderSource(GLuint shader, const std::string &source) = 0;
+  virtual void compileShader(GLuint shader) = 0;
+  virtual GLint getShaderiv(GLuint shader, GLenum pname) = 0;
+  virtual std::string getShaderInfoLog(GLuint shader) = 0;
+
+  virtual GLuint genVertexArray() = 0;
+  virtual void deleteVertexArray(GLuint array) = 0;
+  virtual void bindVertexArray(GLuint array) = 0;
+  virtual void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer) = 0;
+  virtual void enableVertexAttribArray(GLuint index) = 0;
+  virtual void vertexAttribDivisor(GLuint index, GLuint divisor) = 0;
+
+  virtual GLuint genBuffer() = 0;
+  virtual void deleteBuffer(GLuint buffer) = 0;
+  virtual void bindBuffer(GLenum target, GLuint buffer) = 0;
+  virtual void bufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage) = 0;
+  virtual void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data) = 0;
+  virtual void copyBufferSubData(GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size) = 0;
+  virtual GLint getBufferSize(GLenum target) = 0;
+
+  virtual GLuint genTexture() = 0;
+  virtual void deleteTexture(GLuint texture) = 0;
+  virtual void activeTexture(GLenum unit) = 0;
+  virtual void bindTexture(GLenum target, GLuint texture) = 0;
+  virtual void texParameteri(GLenum target, GLenum pname, GLint param) = 0;
+  virtual void pixelStorei(GLenum pname, GLint param) = 0;
+  virtual void texImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height,
+                          GLenum format, GLenum type, const void *data) = 0;
+  // Attaches buffer's storage to the texture bound to target, which must be
+  // GL_TEXTURE_BUFFER.
+  virtual void texBuffer(GLenum target, GLenum internalFormat, GLuint buffer) = 0;
+
+  virtual GLuint genQuery() = 0;
+  virtual void deleteQuery(GLuint query) = 0;
+  virtual void beginQuery(GLenum target, GLuint query) = 0;
+  virtual void endQuery(GLenum target) = 0;
+  virtual GLint getQueryObjectiv(GLuint query, GLenum pname) = 0;
+  virtual GLuint64 getQueryObjectui64v(GLuint query, GLenum pname) = 0;
+
+  virtual std::string getString(GLenum name) = 0;
+  virtual void clearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) = 0;
+  virtual void clear(GLbitfield mask) = 0;
+  virtual void enable(GLenum capability) = 0;
+  virtual void blendFunc(GLenum sfactor, GLenum dfactor) = 0;
+  virtual void hint(GLenum target, GLenum mode) = 0;
+  virtual void viewport(GLint x, GLint y, GLsizei width, GLsizei height) = 0;
+  virtual void patchParameteri(GLenum pname, GLint value) = 0;
+  virtual void drawArrays(GLenum mode, GLint first, GLsizei count) = 0;
+  virtual void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) = 0;
+};
+
+// Backend used by Program, VertexArray and render(). Must be set before any
+// of them is created.
+inline GLBackend *&currentGLBackend() {
+  static GLBackend *backend = 0;
+  return backend;
+}
+inline void setGLBackend(GLBackend *backend) { currentGLBackend() = backend; }
+inline GLBackend &glBackend() { return *currentGLBackend(); }
+
+// Counters kept by RecordingBackend, both in total and since beginFrame().
+struct GLStats {
+  unsigned long long calls;
+  unsigned long long buffersCreated;
+  unsigned long long buffersDeleted;
+  unsigned long long vertexArraysCreated;
+  unsigned long long vertexArraysDeleted;
+  unsigned long long shadersCreated;
+  unsigned long long shadersDeleted;
+  unsigned long long programsCreated;
+  unsigned long long programsDeleted;
+  unsigned long long texturesCreated;
+  unsigned long long texturesDeleted;
+  unsigned long long queriesCreated;
+  unsigned long long queriesDeleted;
+  unsigned long long bytesUploaded;    // data passed to glBufferData/SubData and glTexImage2D
+  unsigned long long bytesAllocated;   // storage sized by glBufferData
+  unsigned long long bytesCopied;      // glCopyBufferSubData traffic
+  unsigned long long drawCalls;
+  unsigned long long verticesDrawn;    // counting every instance
+};
+
+struct DrawCall {
+  GLenum mode;
+  GLint first;
+  GLsizei count;
+  GLsizei instances;
+};
+
+// Headless backend that performs no rendering. It hands out object names,
+// tracks which ones are alive and what size each buffer is, and counts
+// every call, so tests and benchmarks can put budgets on a frame.
+class RecordingBackend : public GLBackend {
+  GLuint nextName;
+  std::map<GLenum, GLuint> bound;
+  std::map<GLuint, GLsizeiptr> bufferSizes;
+
+  void record(const char *name) {
+    // Looked up by the C string, so only a call's first use allocates
+    auto count = callCounts.find(name);
+    if (count == callCounts.end()) count = callCounts.insert(std::make_pair(std::string(name), 0ull)).first;
+    count->second++;
+    total.calls++;
+    frame.calls++;
+  }
+  void add(unsigned long long GLStats::*counter, unsigned long long n = 1) {
+    total.*counter += n;
+    frame.*counter += n;
+  }
+
+public:
+  GLStats total;
+  GLStats frame;
+  std::map<std::string, unsigned long long, std::less<> > callCounts;
+  std::vector<DrawCall> draws;    // draw calls since beginFrame()
+
+  std::set<GLuint> livePrograms;
+  std::set<GLuint> liveShaders;
+  std::set<GLuint> liveVertexArrays;
+  std::set<GLuint> liveBuffers;
+  std::set<GLuint> liveTextures;
+  std::set<GLuint> liveQueries;
+
+  RecordingBackend() : nextName(1), total(), frame() {}
+
+  void beginFrame() {
+    frame = GLStats();
+    draws.clear();
+  }
+
+  // Number of GL objects created and never deleted.
+  size_t liveObjects() const {
+    return livePrograms.size() + liveShaders.size() + liveVertexArrays.size() + liveBuffers.size() +
+           liveTextures.size() + liveQueries.size();
+  }
+
+  GLuint createProgram() {
+    record("glCreateProgram");
+    add(&GLStats::programsCreated);
+    livePrograms.insert(nextName);
+    return nextName++;
+  }
+  void deleteProgram(GLuint program) {
+    record("glDeleteProgram");
+    if (program && livePrograms.erase(program)) add(&GLStats::programsDeleted);
+  }
+  void attachShader(GLuint, GLuint) { record("glAttachShader"); }
+  void linkProgram(GLuint) { record("glLinkProgram"); }
+  GLint getProgramiv(GLuint, GLenum pname) {
+    record("glGetProgramiv");
+    return pname == GL_LINK_STATUS ? GL_TRUE : 0;
+  }
+  std::string getProgramInfoLog(GLuint) {
+    record("glGetProgramInfoLog");
+    return std::string();
+  }
+  void programParameteri(GLuint, GLenum, GLint) { record("glProgramParameteri"); }
+  // There is no driver to produce a binary, so none is ever cached.
+  void getProgramBinary(GLuint, std::vector<char> &binary, GLenum &format) {
+    record("glGetProgramBinary");
+    binary.clear();
+    format = 0;
+  }
+  void programBinary(GLuint, GLenum, const void *, GLsizei) { record("glProgramBinary"); }
+  void useProgram(GLuint) { record("glUseProgram"); }
+  GLint getUniformLocation(GLuint, const char *) {
+    record("glGetUniformLocation");
+    return 0;
+  }
+  void uniform1f(GLint, GLfloat) { record("glUniform1f"); }
+  void uniform1i(GLint, GLint) { record("glUniform1i"); }
+  void uniform2f(GLint, GLfloat, GLfloat) { record("glUniform2f"); }
+  void uniformMatrix4fv(GLint, GLsizei, GLboolean, const GLfloat *) { record("glUniformMatrix4fv"); }
+
+  GLuint createShader(GLenum) {
+    record("glCreateShader");
+    add(&GLStats::shadersCreated);
+    liveShaders.insert(nextName);
+    return nextName++;
+  }
+  void deleteShader(GLuint shader) {
+    record("glDeleteShader");
+    if (shader && liveShaders.erase(shader)) add(&GLStats::shadersDeleted);
+  }
+  void shaderSource(GLuint, const std::string &) { record("glShaderSource"); }
+  void compileShader(GLuint) { record("glCompileShader"); }
+  GLint getShaderiv(GLuint, GLenum pname) {
+    record("glGetShaderiv");
+    return pname == GL_COMPILE_STATUS ? GL_TRUE : 0;
+  }
+  std::string getShaderInfoLog(GLuint) {
+    record("glGetShaderInfoLog");
+    return std::string();
+  }
+
+  GLuint genVertexArray() {
+    record("glGenVertexArrays");
+    add(&GLStats::vertexArraysCreated);
+    liveVertexArrays.insert(nextName);
+    return nextName++;
+  }
+  void deleteVertexArray(GLuint array) {
+    record("glDeleteVertexArrays");
+    if (array && liveVertexArrays.erase(array)) add(&GLStats::vertexArraysDeleted);
+  }
+  void bindVertexArray(GLuint) { record("glBindVertexArray"); }
+  void vertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void *) {
+    record("glVertexAttribPointer");
+  }
+  void enableVertexAttribArray(GLuint) { record("glEnableVertexAttribArray"); }
+  void vertexAttribDivisor(GLuint, GLuint) { record("glVertexAttribDivisor"); }
+
+  GLuint genBuffer() {
+    record("glGenBuffers");
+    add(&GLStats::buffersCreated);
+    liveBuffers.insert(nextName);
+    bufferSizes[nextName] = 0;
+    return nextName++;
+  }
+  void deleteBuffer(GLuint buffer) {
+    record("glDeleteBuffers");
+    if (buffer && liveBuffers.erase(buffer)) {
+      add(&GLStats::buffersDeleted);
+      bufferSizes.erase(buffer);
+    }
+  }
+  void bindBuffer(GLenum target, GLuint buffer) {
+    record("glBindBuffer");
+    bound[target] = buffer;
+  }
+  void bufferData(GLenum target, GLsizeiptr size, const void *data, GLenum) {
+    record("glBufferData");
+    bufferSizes[bound[target]] = size;
+    add(&GLStats::bytesAllocated, size);
+    if (data) add(&GLStats::bytesUploaded, size);
+  }
+  void bufferSubData(GLenum, GLintptr, GLsizeiptr size, const void *) {
+    record("glBufferSubData");
+    add(&GLStats::bytesUploaded, size);
+  }
+  void copyBufferSubData(GLenum, GLenum, GLintptr, GLintptr, GLsizeiptr size) {
+    record("glCopyBufferSubData");
+    add(&GLStats::bytesCopied, size);
+  }
+  GLint getBufferSize(GLenum target) {
+    record("glGetBufferParameteriv");
+    return (GLint)bufferSizes[bound[target]];
+  }
+
+  GLuint genTexture() {
+    record("glGenTextures");
+    add(&GLStats::texturesCreated);
+    liveTextures.insert(nextName);
+    return nextName++;
+  }
+  void deleteTexture(GLuint texture) {
+    record("glDeleteTextures");
+    if (texture && liveTextures.erase(texture)) add(&GLStats::texturesDeleted);
+  }
+  void activeTexture(GLenum) { record("glActiveTexture"); }
+  void bindTexture(GLenum, GLuint) { record("glBindTexture"); }
+  void texParameteri(GLenum, GLenum, GLint) { record("glTexParameteri"); }
+  void pixelStorei(GLenum, GLint) { record("glPixelStorei"); }
+  void texImage2D(GLenum, GLint, GLint, GLsizei width, GLsizei height, GLenum format, GLenum, const void *data) {
+    record("glTexImage2D");
+    // Only the 8-bit formats the atlas uses are sized exactly
+    unsigned long long bytes = (unsigned long long)width * height * (format == GL_RED ? 1 : 4);
+    if (data) add(&GLStats::bytesUploaded, bytes);
+  }
+  void texBuffer(GLenum, GLenum, GLuint) { record("glTexBuffer"); }
+
+  // Queries are ready as soon as they end and measure no time.
+  GLuint genQuery() {
+    record("glGenQueries");
+    add(&GLStats::queriesCreated);
+    liveQueries.insert(nextName);
+    return nextName++;
+  }
+  void deleteQuery(GLuint query) {
+    record("glDeleteQueries");
+    if (query && liveQueries.erase(query)) add(&GLStats::queriesDeleted);
+  }
+  void beginQuery(GLenum, GLuint) { record("glBeginQuery"); }
+  void endQuery(GLenum) { record("glEndQuery"); }
+  GLint getQueryObjectiv(GLuint, GLenum pname) {
+    record("glGetQueryObjectiv");
+    return pname == GL_QUERY_RESULT_AVAILABLE ? GL_TRUE : 0;
+  }
+  GLuint64 getQueryObjectui64v(GLuint, GLenum) {
+    record("glGetQueryObjectui64v");
+    return 0;
+  }
+
+  std::string getString(GLenum) {
+    record("glGetString");
+    return "RecordingBackend";
+  }
+  void clearColor(GLfloat, GLfloat, GLfloat, GLfloat) { record("glClearColor"); }
+  void clear(GLbitfield) { record("glClear"); }
+  void enable(GLenum) { record("glEnable"); }
+  void blendFunc(GLenum, GLenum) { record("glBlendFunc"); }
+  void hint(GLenum, GLenum) { record("glHint"); }
+  void viewport(GLint, GLint, GLsizei, GLsizei) { record("glViewport"); }
+  void patchParameteri(GLenum, GLint) { record("glPatchParameteri"); }
+  void drawArrays(GLenum mode, GLint first, GLsizei count) {
+    record("glDrawArrays");
+    add(&GLStats::drawCalls);
+    add(&GLStats::verticesDrawn, count);
+    DrawCall draw = { mode, first, count, 1 };
+    draws.push_back(draw);
+  }
+  void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+    record("glDrawArraysInstanced");
+    add(&GLStats::drawCalls);
+    add(&GLStats::verticesDrawn, (unsigned long long)count * instances);
+    DrawCall draw = { mode, first, count, instances };
+    draws.push_back(draw);
+  }
+};
+
+#endif
@@ -0,0 +1,437 @@
+// ==========================================================================
+// Shader program, vertex array and texture wrappers
+//
+// All of them issue their GL calls through the backend current when they are
+// created (see glbackend.h).
+// ==========================================================================
+
+#ifndef GLOBJECTS_H
+#define GLOBJECTS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+
+#include <sys/stat.h>
+
+#include "glbackend.h"
+
+// Directory linked program binaries are cached in, ending in '/'. Empty, the
+// default, compiles every program from source.
+inline std::string &programCacheDirectory() {
+  static std::string directory;
+  return directory;
+}
+
+const uint32_t PROGRAM_MAGIC = 0x31424750;   // "PGB1"
+
+struct ProgramBinaryHeader {
+  uint32_t magic;
+  uint32_t format;
+  uint64_t key;
+  uint64_t size;
+};
+
+// Shader program. With a cache directory set, the linked binary is saved
+// under a key hashed from the stage sources and the driver's vendor,
+// renderer and version strings, and later runs load it instead of
+// compiling. A binary the driver rejects falls back to compiling.
+class Program {
+  GLuint vertex_shader;
+  GLuint tess_control_shader;
+  GLuint tess_evaluation_shader;
+  GLuint fragment_shader;
+
+  static void mix(uint64_t &hash, const std::string &data) {
+    for (size_t i = 0; i <= data.size(); i++) {
+      hash ^= (unsigned char)data.c_str()[i];
+      hash *= 1099511628211ULL;
+    }
+  }
+
+  static std::string hex(uint64_t value) {
+    char digits[17];
+    snprintf(digits, sizeof(digits), "%016llx", (unsigned long long)value);
+    return digits;
+  }
+
+  bool loadBinary(const std::string &path, uint64_t key) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL) return false;
+    ProgramBinaryHeader header;
+    std::vector<char> binary;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && header.magic == PROGRAM_MAGIC &&
+              header.key == key && header.size > 0 && header.size < (1u << 30);
+    if (ok) {
+      binary.resize(header.size);
+      ok = fread(binary.data(), 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+    if (!ok) return false;
+    gl->programBinary(id, header.format, binary.data(), binary.size());
+    return gl->getProgramiv(id, GL_LINK_STATUS) == GL_TRUE;
+  }
+
+  bool saveBinary(const std::string &path, uint64_t key) {
+    std::vector<char> binary;
+    GLenum format = 0;
+    gl->getProgramBinary(id, binary, format);
+    if (binary.empty()) return true;   // the driver offers no binary
+    mkdir(programCacheDirectory().c_str(), 0755);
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL) return false;
+    ProgramBinaryHeader header = { PROGRAM_MAGIC, format, key, binary.size() };
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(binary.data(), 1, binary.size(), file);
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+  }
+
+public:
+  GLBackend *gl;
+  GLuint id;
+  bool linked;
+  bool cached;   // loaded from the binary cache
+  Program() : gl(&glBackend()) {
+    vertex_shader=0;
+    tess_control_shader=0;
+    tess_evaluation_shader=0;
+    fragment_shader=0;
+    id=0;
+    linked=false;
+    cached=false;
+  }
+  Program(std::string vertex_path, std::string tess_control_path, std::string tess_evaluation_path, std::string fragment_path) : Program() {
+    init(vertex_path, tess_control_path, tess_evaluation_path, fragment_path);
+  }
+  // Program without tessellation stages.
+  Program(std::string vertex_path, std::string fragment_path) : Program() {
+    init(vertex_path, "", "", fragment_path);
+  }
+  // Empty paths leave their stage out.
+  void init(std::string vertex_path, std::string tess_control_path, std::string tess_evaluation_path, std::string fragment_path) {
+    std::string paths[4] = { vertex_path, tess_control_path, tess_evaluation_path, fragment_path };
+    std::string sources[4];
+    uint64_t name = 14695981039346656037ULL, key = name;
+    mix(key, gl->getString(GL_VENDOR));
+    mix(key, gl->getString(GL_RENDERER));
+    mix(key, gl->getString(GL_VERSION));
+    for (int i = 0; i < 4; i++) {
+      mix(name, paths[i]);
+      if (paths[i].empty()) continue;
+      std::ifstream in(paths[i]);
+      if (!in) std::cerr << "Impossible to open the file, " << paths[i] << std::endl;
+      std::ostringstream ss{};
+      ss << in.rdbuf();
+      sources[i] = ss.str();
+      mix(key, paths[i]);
+      mix(key, sources[i]);
+    }
+
+    id=gl->createProgram();
+    std::string cachePath;
+    if (!programCacheDirectory().empty()) {
+      cachePath = programCacheDirectory() + hex(name) + ".bin";
+      if (loadBinary(cachePath, key)) {
+        linked = cached = true;
+        return;
+      }
+      // A rejected binary can leave the program unusable, so start afresh
+      gl->deleteProgram(id);
+      id=gl->createProgram();
+      gl->programParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    vertex_shader=paths[0].empty() ? 0 : compileShader(sources[0],GL_VERTEX_SHADER);
+    tess_control_shader=paths[1].empty() ? 0 : compileShader(sources[1],GL_TESS_CONTROL_SHADER);
+    tess_evaluation_shader=paths[2].empty() ? 0 : compileShader(sources[2],GL_TESS_EVALUATION_SHADER);
+    fragment_shader=paths[3].empty() ? 0 : compileShader(sources[3],GL_FRAGMENT_SHADER);
+    if(vertex_shader) gl->attachShader(id,vertex_shader);
+    if(tess_control_shader) gl->attachShader(id,tess_control_shader);
+    if(tess_evaluation_shader) gl->attachShader(id,tess_evaluation_shader);
+    if(fragment_shader) gl->attachShader(id,fragment_shader);
+
+    gl->linkProgram(id);
+
+    // Link results
+    linked = gl->getProgramiv(id, GL_LINK_STATUS) == GL_TRUE;
+    if (!linked) {
+      std::cerr << "ERROR linking program:" << std::endl << std::endl;
+      std::cerr << gl->getProgramInfoLog(id) << std::endl;
+    } else if (!cachePath.empty() && !saveBinary(cachePath, key)) {
+      std::cerr << "Impossible to write the file, " << cachePath << std::endl;
+    }
+  }
+  GLuint compileShader(const std::string &source, GLuint type) {
+    GLuint shader = gl->createShader(type);
+
+    gl->shaderSource(shader, source);
+  	gl->compileShader(shader);
+
+    // Compile results
+  	if (gl->getShaderiv(shader, GL_COMPILE_STATUS) == GL_FALSE)
+  	{
+  		std::string info = gl->getShaderInfoLog(shader);
+  		std::cerr << "ERROR compiling shader:" << std::endl << std::endl;
+  		std::cerr << info << std::endl;
+  	}
+    return shader;
+  }
+  ~Program() {
+    gl->useProgram(0);
+    gl->deleteProgram(id);
+    gl->deleteShader(vertex_shader);
+    gl->deleteShader(tess_control_shader);
+    gl->deleteShader(tess_evaluation_shader);
+    gl->deleteShader(fragment_shader);
+  }
+};
+
+// Vertex array whose buffers persist for its whole life. Buffers are
+// allocated with spare capacity and grown geometrically, and updates are
+// written in place with glBufferSubData, so steady-state updates create no
+// GL objects. Buffers hold floats, or 16-bit integers the shader reads as
+// floats of the same value. Move-only: a VertexArray owns its GL names.
+class VertexArray {
+  struct Buffer {
+    GLuint id;
+    int index;
+    int components;
+    GLenum type;           // GL_FLOAT or GL_SHORT
+    GLsizeiptr size;       // bytes per value
+    GLsizeiptr capacity;   // bytes of storage allocated
+  };
+  std::map<std::string,Buffer> buffers;
+
+  // Points the buffer's attribute at element first; the buffer must be bound.
+  void pointAttribute(const Buffer &b, size_t first) {
+    gl->vertexAttribPointer(b.index, b.components, b.type, GL_FALSE, 0,
+                            (const void *)(first * b.components * b.size));
+  }
+
+  // Reallocates buffer with room for at least bytes, keeping the first keep
+  // bytes of its contents. A new buffer is only created when contents must
+  // be kept; otherwise the storage is orphaned and reallocated in place.
+  void grow(Buffer &buffer, GLsizeiptr bytes, GLsizeiptr keep) {
+    GLsizeiptr capacity = buffer.capacity ? buffer.capacity : 64;
+    while (capacity < bytes) capacity *= 2;
+
+    if (keep == 0) {
+      gl->bindBuffer(GL_ARRAY_BUFFER, buffer.id);
+      gl->bufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+      gl->bindBuffer(GL_ARRAY_BUFFER, 0);
+    } else {
+      GLuint grown = gl->genBuffer();
+      gl->bindBuffer(GL_COPY_WRITE_BUFFER, grown);
+      gl->bufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+      gl->bindBuffer(GL_COPY_READ_BUFFER, buffer.id);
+      gl->copyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, keep);
+      gl->bindBuffer(GL_COPY_READ_BUFFER, 0);
+      gl->bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+      gl->deleteBuffer(buffer.id);
+      buffer.id = grown;
+
+      // Point the attribute at the new buffer
+      gl->bindVertexArray(id);
+      gl->bindBuffer(GL_ARRAY_BUFFER, buffer.id);
+      pointAttribute(buffer, 0);
+      gl->bindBuffer(GL_ARRAY_BUFFER, 0);
+      gl->bindVertexArray(0);
+    }
+    buffer.capacity = capacity;
+  }
+
+  void release() {
+    if (!gl) return;
+    gl->bindVertexArray(0);
+    gl->deleteVertexArray(id);
+    gl->bindBuffer(GL_ARRAY_BUFFER, 0);
+    for(auto &ent: buffers)
+  	  gl->deleteBuffer(ent.second.id);
+    buffers.clear();
+  }
+
+  void create(const std::string &name, int index, int components, int divisor, GLenum type, GLsizeiptr size) {
+    Buffer &b = buffers[name];
+    b.index = index;
+    b.components = components;
+    b.type = type;
+    b.size = size;
+    b.capacity = 0;
+
+    gl->bindVertexArray(id);
+
+    b.id = gl->genBuffer();
+    gl->bindBuffer(GL_ARRAY_BUFFER, b.id);
+    pointAttribute(b, 0);
+    gl->enableVertexAttribArray(index);
+    if (divisor) gl->vertexAttribDivisor(index, divisor);
+
+    // unset states
+    gl->bindBuffer(GL_ARRAY_BUFFER, 0);
+    gl->bindVertexArray(0);
+  }
+
+  // Writes bytes at start, keeping the rest of the buffer.
+  void write(Buffer &b, GLsizeiptr start, GLsizeiptr bytes, const void *data) {
+    if (start + bytes > b.capacity) grow(b, start + bytes, start);
+    if (bytes == 0) return;
+
+    gl->bindBuffer(GL_ARRAY_BUFFER, b.id);
+    gl->bufferSubData(GL_ARRAY_BUFFER, start, bytes, data);
+    gl->bindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+public:
+  GLBackend *gl;
+  GLuint id;
+  unsigned int count;
+  VertexArray(int c) : gl(&glBackend()) {
+    id = gl->genVertexArray();
+    count = c;
+  }
+
+  VertexArray(const VertexArray &) = delete;
+  VertexArray &operator=(const VertexArray &) = delete;
+
+  VertexArray(VertexArray &&v) : buffers(std::move(v.buffers)), gl(v.gl), id(v.id), count(v.count) {
+    v.gl = 0;
+    v.id = 0;
+  }
+  VertexArray &operator=(VertexArray &&v) {
+    if (this != &v) {
+      release();
+      buffers = std::move(v.buffers);
+      gl = v.gl;
+      id = v.id;
+      count = v.count;
+      v.gl = 0;
+      v.id = 0;
+    }
+    return *this;
+  }
+
+  // Adds a float buffer feeding attribute index with components values per
+  // vertex, or per instance if divisor is 1.
+  void addBuffer(const std::string &name, int index, const std::vector<float> &buffer,
+                 int components = 2, int divisor = 0) {
+    create(name, index, components, divisor, GL_FLOAT, sizeof(float));
+    updateBuffer(name, buffer);
+  }
+
+  // Adds a buffer of 16-bit integers, which the shader reads unnormalized:
+  // 1000 arrives as 1000.0.
+  void addBuffer(const std::string &name, int index, const std::vector<int16_t> &buffer,
+                 int components = 2, int divisor = 0) {
+    create(name, index, components, divisor, GL_SHORT, sizeof(int16_t));
+    updateBuffer(name, buffer);
+  }
+
+  // Points a buffer's attribute at element first instead of the start. GL
+  // 4.1 has no base instance, so this is how an instanced draw starts part
+  // way through a per-instance buffer. Leaves the vertex array bound for
+  // the draw.
+  void setFirstElement(const std::string &name, size_t first) {
+    Buffer &b = buffers[name];
+    gl->bindVertexArray(id);
+    gl->bindBuffer(GL_ARRAY_BUFFER, b.id);
+    pointAttribute(b, first);
+    gl->bindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // Replaces the contents of a buffer. Storage is only reallocated when the
+  // data no longer fits.
+  void updateBuffer(const std::string &name, const std::vector<float> &buffer) {
+    updateBuffer(name, 0, buffer.data(), buffer.size());
+  }
+
+  void updateBuffer(const std::string &name, const std::vector<int16_t> &buffer) {
+    updateBuffer(name, 0, buffer.data(), buffer.size());
+  }
+
+  // Writes values [offset, offset + size) of a buffer, keeping the rest.
+  // The data must be of the buffer's type.
+  void updateBuffer(const std::string &name, size_t offset, const float *data, size_t size) {
+    write(buffers[name], offset * sizeof(float), size * sizeof(float), data);
+  }
+  void updateBuffer(const std::string &name, size_t offset, const int16_t *data, size_t size) {
+    write(buffers[name], offset * sizeof(int16_t), size * sizeof(int16_t), data);
+  }
+  // Copies values [from, from + size) of a buffer to values from to, on the
+  // GPU, growing it if need be. The two ranges must not overlap.
+  void copyBuffer(const std::string &name, size_t from, size_t to, size_t size) {
+    Buffer &b = buffers[name];
+    GLsizeiptr end = (to + size) * b.size;
+    if (end > b.capacity) grow(b, end, b.capacity);
+    if (size == 0) return;
+    gl->bindBuffer(GL_COPY_READ_BUFFER, b.id);
+    gl->bindBuffer(GL_COPY_WRITE_BUFFER, b.id);
+    gl->copyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, from * b.size, to * b.size, size * b.size);
+    gl->bindBuffer(GL_COPY_READ_BUFFER, 0);
+    gl->bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+
+  ~VertexArray() {
+    release();
+  }
+};
+
+// Single-channel 8-bit 2D texture, sampled with linear filtering and
+// clamped at the edges. Move-only, like VertexArray.
+class Texture {
+  void release() {
+    if (gl) gl->deleteTexture(id);
+  }
+
+public:
+  GLBackend *gl;
+  GLuint id;
+  int width;
+  int height;
+
+  // pixels holds width x height bytes, bottom row first.
+  Texture(int w, int h, const unsigned char *pixels) : gl(&glBackend()), width(w), height(h) {
+    id = gl->genTexture();
+    gl->bindTexture(GL_TEXTURE_2D, id);
+    gl->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    gl->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gl->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl->texParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl->pixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    gl->texImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, GL_RED, GL_UNSIGNED_BYTE, pixels);
+    gl->pixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    gl->bindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  Texture(const Texture &) = delete;
+  Texture &operator=(const Texture &) = delete;
+
+  Texture(Texture &&t) : gl(t.gl), id(t.id), width(t.width), height(t.height) {
+    t.gl = 0;
+    t.id = 0;
+  }
+  Texture &operator=(Texture &&t) {
+    if (this != &t) {
+      release();
+      gl = t.gl;
+      id = t.id;
+      width = t.width;
+      height = t.height;
+      t.gl = 0;
+      t.id = 0;
+    }
+    return *this;
+  }
+
+  ~Texture() {
+    release();
+  }
+};
+
+#endif
@@ -0,0 +1,270 @@
+// ==========================================================================
+// Instanced glyph geometry
+//
+// Every glyph's patches are uploaded once, in glyph space, into one shared
+// buffer, and a string is drawn from a small per-instance buffer of pen
+// position and scale. Instances are grouped by glyph and each group is one
+// instanced draw of that glyph's range, so changing the text uploads 12
+// bytes per character instead of 32 bytes per patch.
+//
+// The shared buffer is compact: control points are 16-bit fixed point
+// relative to the glyph origin, and L and Z records stay 2-point lines
+// instead of being promoted to cubics. A glyph's cubics come first in its
+// range, drawn as 4-vertex patches, and its lines after them, drawn as
+// 2-vertex patches that tessControl.glsl expands. A cubic takes 16 bytes
+// and a line 8, against 32 for either as floats.
+//
+// Filled geometry holds each glyph's triangulation (see fill.h) in the same
+// 16-bit format instead, drawn as instanced triangles without tessellation.
+// ==========================================================================
+
+#ifndef GLYPHGEOMETRY_H
+#define GLYPHGEOMETRY_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "fill.h"
+#include "globjects.h"
+#include "glyphs.h"
+#include "layout.h"
+
+// Glyph coordinates are stored as multiples of GLYPH_QUANTUM, which spans
+// +-GLYPH_RANGE glyph units in 16 bits; cmuntt stays within -0.39 to 1.05.
+// Glyphs of other fonts that reach past it are refused, not clamped.
+const float GLYPH_RANGE = 2.0f;
+const float GLYPH_QUANTUM = GLYPH_RANGE / 32767.0f;
+
+// Most pixels a glyph unit is drawn across. Rounding moves a control point
+// by at most half a quantum on each axis, 0.18 px at this zoom, and the
+// curve by no more than its control points.
+const float MAX_GLYPH_PIXELS = 4096.0f;
+
+inline int16_t quantizeCoord(float v) {
+  float q = std::round(v / GLYPH_QUANTUM);
+  return (int16_t)std::max(-32767.0f, std::min(32767.0f, q));
+}
+
+inline float dequantizeCoord(int16_t q) { return q * GLYPH_QUANTUM; }
+
+// Whether every control point of outline is within +-GLYPH_RANGE.
+inline bool fitsGlyphRange(const OutlineView &outline) {
+  for (size_t i = 0; i < outline.coordCount; i++)
+    if (!(std::fabs(outline.coords[i]) <= GLYPH_RANGE)) return false;
+  return true;
+}
+
+// Appends the segments of one glyph outline in glyph space: cubics to
+// cubics as 4 points and lines to lines as 2, 2 values per point. Closing
+// lines of zero length are left out.
+inline void appendCompactPatches(const OutlineView &outline, std::vector<int16_t> &cubics,
+                                 std::vector<int16_t> &lines) {
+  int16_t start[2] = {}, pen[2] = {};
+  const float *c = outline.coords;
+  for (size_t i = 0; i < outline.commandCount; i++) {
+    switch (outline.commands[i]) {
+      case 'M':
+        start[0] = pen[0] = quantizeCoord(c[0]);
+        start[1] = pen[1] = quantizeCoord(c[1]);
+        c += 2;
+        break;
+      case 'C':
+        cubics.insert(cubics.end(), { pen[0], pen[1], quantizeCoord(c[0]), quantizeCoord(c[1]),
+                                      quantizeCoord(c[2]), quantizeCoord(c[3]) });
+        pen[0] = quantizeCoord(c[4]);
+        pen[1] = quantizeCoord(c[5]);
+        cubics.insert(cubics.end(), { pen[0], pen[1] });
+        c += 6;
+        break;
+      case 'L':
+        lines.insert(lines.end(), { pen[0], pen[1] });
+        pen[0] = quantizeCoord(c[0]);
+        pen[1] = quantizeCoord(c[1]);
+        lines.insert(lines.end(), { pen[0], pen[1] });
+        c += 2;
+        break;
+      case 'Z':
+        if (pen[0] != start[0] || pen[1] != start[1])
+          lines.insert(lines.end(), { pen[0], pen[1], start[0], start[1] });
+        pen[0] = start[0];
+        pen[1] = start[1];
+        break;
+    }
+  }
+}
+
+class GlyphGeometry {
+public:
+  struct Range {
+    GLint first;          // vertices into the shared buffer
+    GLsizei cubics;       // vertices of 4-vertex patches from first
+    GLsizei lines;        // vertices of 2-vertex patches after those
+    GLsizei triangles;    // vertices of triangles from first, when filled
+
+    bool empty() const { return cubics + lines + triangles == 0; }
+  };
+  // One instanced draw of a glyph's range.
+  struct Batch {
+    Range range;
+    size_t firstInstance;
+    GLsizei instances;
+  };
+
+private:
+  GlyphCache *glyphs;
+  bool filled;
+  std::unordered_map<int, Range> ranges;   // by code point
+  size_t vertices;                         // in the shared buffer
+  std::vector<int16_t> patches;
+  std::vector<int16_t> cubics;
+  std::vector<int16_t> lines;
+  std::vector<float> triangles;
+  std::vector<float> instanceData;
+  std::vector<size_t> order;
+  std::vector<Batch> batches;
+
+public:
+  size_t refused;   // glyphs addGlyphs() found too large to store
+  VertexArray va;   // "glyphs" at attribute 0, "instances" at attribute 1
+
+  // filled draws the glyphs' interiors instead of their outlines.
+  explicit GlyphGeometry(GlyphCache &cache, bool fill = false)
+    : glyphs(&cache), filled(fill), vertices(0), refused(0), va(0) {
+    va.addBuffer("glyphs", 0, std::vector<int16_t>());
+    va.addBuffer("instances", 1, std::vector<float>(), 3, 1);
+  }
+
+  // Uploads the glyphs of layout that are not in the shared buffer yet.
+  // Glyphs a preload has not published yet are left out until a later call;
+  // glyphs too large for the 16-bit format get an empty range, with a
+  // message, and are never drawn.
+  void addGlyphs(const TextLayout &layout) {
+    patches.clear();
+    size_t added = vertices;
+    for (const GlyphPlacement &placement : layout.glyphs) {
+      if (ranges.count(placement.code)) continue;
+      OutlineView outline = glyphs->get(placement.code);
+      if (!glyphs->ready(placement.code)) continue;
+      Range range = { (GLint)(added + patches.size() / 2), 0, 0, 0 };
+      if (!fitsGlyphRange(outline)) {
+        std::cerr << "Not drawing glyph " << placement.code << ": it reaches past +-" << GLYPH_RANGE
+                  << " glyph units" << std::endl;
+        refused++;
+      } else if (filled) {
+        triangles.clear();
+        triangulateOutline(outline, triangles);
+        for (float v : triangles) patches.push_back(quantizeCoord(v));
+        range.triangles = triangles.size() / 2;
+      } else {
+        cubics.clear();
+        lines.clear();
+        appendCompactPatches(outline, cubics, lines);
+        range.cubics = cubics.size() / 2;
+        range.lines = lines.size() / 2;
+        patches.insert(patches.end(), cubics.begin(), cubics.end());
+        patches.insert(patches.end(), lines.begin(), lines.end());
+      }
+      ranges[placement.code] = range;
+    }
+    if (!patches.empty()) {
+      va.updateBuffer("glyphs", vertices * 2, patches.data(), patches.size());
+      vertices += patches.size() / 2;
+    }
+  }
+
+  // Range of code's glyph in the shared buffer, or 0 if it is not there.
+  const Range *range(int code) const {
+    auto found = ranges.find(code);
+    return found == ranges.end() ? 0 : &found->second;
+  }
+
+  // Uploads the glyphs of layout as addGlyphs() does and replaces the
+  // instances with layout's placements.
+  void setText(const TextLayout &layout, float scale = 1.0f) {
+    addGlyphs(layout);
+
+    // Group the instances by glyph
+    const std::vector<GlyphPlacement> &placed = layout.glyphs;
+    order.resize(placed.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    // Ties in text order, as a stable sort would leave them without its buffer
+    std::sort(order.begin(), order.end(), [&placed](size_t a, size_t b) {
+      return placed[a].code < placed[b].code || (placed[a].code == placed[b].code && a < b);
+    });
+
+    instanceData.clear();
+    batches.clear();
+    int batchCode = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+      const GlyphPlacement &p = placed[order[i]];
+      auto range = ranges.find(p.code);
+      if (range == ranges.end()) continue;
+      if (batches.empty() || batchCode != p.code) {
+        Batch batch = { range->second, instanceData.size() / 3, 0 };
+        batches.push_back(batch);
+        batchCode = p.code;
+      }
+      // The shader reads the coordinates as integers; the scale restores units
+      instanceData.insert(instanceData.end(), { p.x, p.y, scale * GLYPH_QUANTUM });
+      batches.back().instances++;
+    }
+    // Glyphs with no outline have nothing to draw
+    batches.erase(std::remove_if(batches.begin(), batches.end(), [](const Batch &b) { return b.range.empty(); }),
+                  batches.end());
+    va.updateBuffer("instances", instanceData);
+    va.count = instanceData.size() / 3;
+  }
+
+  // Issues instanced draws of GL_PATCHES, one per glyph in the text for its
+  // cubics and one for its lines, or of GL_TRIANGLES, one per glyph, when
+  // filled. The program must already be in use; this sets the patch size
+  // and leaves it at 4, as other patch drawing expects.
+  void draw() { draw(batches); }
+
+  // Draws groups of instances from the instance buffer, as draw() does
+  // the text's. For callers that lay out the instance buffer themselves.
+  void draw(const std::vector<Batch> &groups) {
+    GLBackend *gl = va.gl;
+    if (filled) {
+      for (const Batch &batch : groups) {
+        va.setFirstElement("instances", batch.firstInstance);
+        gl->drawArraysInstanced(GL_TRIANGLES, batch.range.first, batch.range.triangles, batch.instances);
+      }
+      gl->bindVertexArray(0);
+      return;
+    }
+    gl->patchParameteri(GL_PATCH_VERTICES, 4);
+    for (const Batch &batch : groups) {
+      if (!batch.range.cubics) continue;
+      va.setFirstElement("instances", batch.firstInstance);
+      gl->drawArraysInstanced(GL_PATCHES, batch.range.first, batch.range.cubics, batch.instances);
+    }
+    gl->patchParameteri(GL_PATCH_VERTICES, 2);
+    for (const Batch &batch : groups) {
+      if (!batch.range.lines) continue;
+      va.setFirstElement("instances", batch.firstInstance);
+      gl->drawArraysInstanced(GL_PATCHES, batch.range.first + batch.range.cubics, batch.range.lines,
+                              batch.instances);
+    }
+    gl->patchParameteri(GL_PATCH_VERTICES, 4);
+    gl->bindVertexArray(0);
+  }
+
+  size_t drawCount() const { return drawCount(batches); }
+  static size_t drawCount(const std::vector<Batch> &groups) {
+    size_t draws = 0;
+    for (const Batch &batch : groups)
+      draws += (batch.range.cubics > 0) + (batch.range.lines > 0) + (batch.range.triangles > 0);
+    return draws;
+  }
+  size_t glyphCount() const { return ranges.size(); }
+
+  // Bytes of glyph geometry in the shared buffer.
+  size_t geometryBytes() const { return vertices * 2 * sizeof(int16_t); }
+};
+
+#endif
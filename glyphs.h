@@ -0,0 +1,590 @@
+// ==========================================================================
+// Glyph outlines for the cmuntt/ font
+//
+// Each cmuntt/gly_<code> file holds the outline of one glyph as a list of
+// M (move), C (cubic), L (line) and Z (close) records in glyph space.
+// ==========================================================================
+
+#ifndef GLYPHS_H
+#define GLYPHS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#include <dirent.h>
+
+#include "fontpack.h"
+#include "threadpool.h"
+
+// Parsed outline of a single glyph, in untransformed glyph space.
+struct Outline {
+  std::vector<char> commands;   // 'M', 'C', 'L' or 'Z'
+  std::vector<float> coords;    // x/y pairs: 1 per M and L, 3 per C, 0 per Z
+};
+
+// Read-only view of an outline, either owned by a GlyphCache or mapped
+// straight out of a FontPack.
+struct OutlineView {
+  const char *commands;
+  size_t commandCount;
+  const float *coords;
+  size_t coordCount;
+
+  OutlineView() : commands(0), commandCount(0), coords(0), coordCount(0) {}
+};
+
+// Measurements of one glyph, in glyph units. The font carries no advance
+// widths; it is monospaced with every glyph centred in its cell, so the
+// advance is taken as the ink width plus equal bearings on both sides.
+struct GlyphMetrics {
+  float bbox[4];        // exact ink bounds: x min, y min, x max, y max
+  float advance;        // pen movement after the glyph
+  float leftBearing;    // pen position to the left ink edge
+  float rightBearing;   // right ink edge to the next pen position
+};
+
+// One glyph of a font compiled into the program (see fontpack -header): its
+// records and coordinates are ranges of the font's shared arrays, and its
+// metrics are measured at build time.
+struct EmbeddedGlyph {
+  int code;
+  unsigned firstCommand;
+  unsigned commandCount;
+  unsigned firstCoord;
+  unsigned coordCount;
+  GlyphMetrics metrics;
+};
+
+struct EmbeddedFont {
+  const EmbeddedGlyph *glyphs;   // sorted by code point
+  size_t glyphCount;
+  const char *commands;
+  const float *coords;
+};
+
+// Extends [lo, hi] by the extrema of one coordinate of a cubic.
+inline void cubicRange(float p0, float p1, float p2, float p3, float &lo, float &hi) {
+  lo = std::min(lo, std::min(p0, p3));
+  hi = std::max(hi, std::max(p0, p3));
+  if (std::min(p1, p2) >= lo && std::max(p1, p2) <= hi) return;
+
+  // Roots of the derivative, divided by 3: a t^2 + b t + c
+  float a = -p0 + 3.0f * p1 - 3.0f * p2 + p3;
+  float b = 2.0f * (p0 - 2.0f * p1 + p2);
+  float c = p1 - p0;
+  float roots[2];
+  int count = 0;
+  if (std::fabs(a) < 1e-12f) {
+    if (std::fabs(b) > 1e-12f) roots[count++] = -c / b;
+  } else {
+    float d = b * b - 4.0f * a * c;
+    if (d >= 0.0f) {
+      float q = std::sqrt(d);
+      roots[count++] = (-b + q) / (2.0f * a);
+      roots[count++] = (-b - q) / (2.0f * a);
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    float t = roots[i];
+    if (t <= 0.0f || t >= 1.0f) continue;
+    float u = 1.0f - t;
+    float v = u * u * u * p0 + 3.0f * u * u * t * p1 + 3.0f * u * t * t * p2 + t * t * t * p3;
+    lo = std::min(lo, v);
+    hi = std::max(hi, v);
+  }
+}
+
+inline GlyphMetrics measureOutline(const OutlineView &outline) {
+  GlyphMetrics m = {};
+  if (outline.coordCount < 2) return m;
+
+  float bbox[4] = { outline.coords[0], outline.coords[1], outline.coords[0], outline.coords[1] };
+  const float *c = outline.coords;
+  float pen[2] = { c[0], c[1] };
+  for (size_t i = 0; i < outline.commandCount; i++) {
+    switch (outline.commands[i]) {
+      case 'M': case 'L':
+        bbox[0] = std::min(bbox[0], c[0]);
+        bbox[1] = std::min(bbox[1], c[1]);
+        bbox[2] = std::max(bbox[2], c[0]);
+        bbox[3] = std::max(bbox[3], c[1]);
+        pen[0] = c[0];
+        pen[1] = c[1];
+        c += 2;
+        break;
+      case 'C':
+        cubicRange(pen[0], c[0], c[2], c[4], bbox[0], bbox[2]);
+        cubicRange(pen[1], c[1], c[3], c[5], bbox[1], bbox[3]);
+        pen[0] = c[4];
+        pen[1] = c[5];
+        c += 6;
+        break;
+    }
+  }
+
+  std::copy(bbox, bbox + 4, m.bbox);
+  m.advance = std::max(bbox[0] + bbox[2], bbox[2]);
+  m.leftBearing = bbox[0];
+  m.rightBearing = m.advance - bbox[2];
+  return m;
+}
+
+// Reads a decimal float ("-0.207", "12", "1.5e-3") starting at p, without
+// going through the C locale. Returns the position after the number, or p if
+// there is no number there.
+inline const char *parseFloat(const char *p, const char *end, float &value) {
+  const char *start = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+  unsigned long long mantissa = 0;
+  int exponent = 0;
+  int digits = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+    if (mantissa < 100000000000000000ULL) mantissa = mantissa * 10 + (*p - '0');
+    else exponent++;
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+      if (mantissa < 100000000000000000ULL) {
+        mantissa = mantissa * 10 + (*p - '0');
+        exponent--;
+      }
+    }
+  }
+  if (digits == 0) return start;
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    bool negativeExponent = false;
+    if (q < end && (*q == '-' || *q == '+')) negativeExponent = *q++ == '-';
+    if (q < end && *q >= '0' && *q <= '9') {
+      int e = 0;
+      for (; q < end && *q >= '0' && *q <= '9'; q++) if (e < 10000) e = e * 10 + (*q - '0');
+      exponent += negativeExponent ? -e : e;
+      p = q;
+    }
+  }
+
+  static const double powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  double result = (double)mantissa;
+  for (; exponent < -22; exponent += 22) result /= powers[22];
+  for (; exponent > 22; exponent -= 22) result *= powers[22];
+  result = exponent < 0 ? result / powers[-exponent] : result * powers[exponent];
+
+  value = (float)(negative ? -result : result);
+  return p;
+}
+
+// Tokenizes a glyph file held in memory into outline. The outline is sized
+// exactly up front from a count of the record letters and filled in place,
+// so a reused outline with enough capacity is parsed without allocating.
+inline void parseOutline(const char *begin, const char *end, Outline &outline) {
+  size_t commandCount = 0;
+  size_t coordCount = 0;
+  for (const char *p = begin; p < end; p++) {
+    switch (*p) {
+      case 'M': case 'L': commandCount++; coordCount += 2; break;
+      case 'C': commandCount++; coordCount += 6; break;
+      case 'Z': commandCount++; break;
+    }
+  }
+  outline.commands.resize(commandCount);
+  outline.coords.resize(coordCount);
+
+  char *command = outline.commands.data();
+  float *coord = outline.coords.data();
+  const char *p = begin;
+  while (p < end) {
+    char c = *p;
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      p++;
+      continue;
+    }
+
+    int count;
+    switch (c) {
+      case 'M': case 'L': count = 2; break;
+      case 'C': count = 6; break;
+      case 'Z': count = 0; break;
+      default:
+        // Skip anything that isn't a record, including stray numbers.
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
+        continue;
+    }
+    *command++ = c;
+    p++;
+
+    for (int i = 0; i < count; i++) {
+      while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+      const char *next = parseFloat(p, end, *coord);
+      if (next == p) *coord = 0.0f;
+      coord++;
+      p = next;
+    }
+  }
+}
+
+// Reads glyph files through one reusable buffer, so parsing a set of glyphs
+// costs one read per file and no per-token calls into stdio.
+class OutlineParser {
+  std::vector<char> buffer;
+
+public:
+  // Reads a glyph file into outline. Returns false if the file can't be opened.
+  bool read(const std::string &path, Outline &outline) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL) return false;
+
+    size_t size = 0;
+    if (buffer.size() < 4096) buffer.resize(4096);
+    for (;;) {
+      size += fread(buffer.data() + size, 1, buffer.size() - size, file);
+      if (size < buffer.size()) break;
+      buffer.resize(buffer.size() * 2);
+    }
+    fclose(file);
+
+    parseOutline(buffer.data(), buffer.data() + size, outline);
+    return true;
+  }
+};
+
+// Code points of every gly_<code> file in directory, in directory order.
+inline std::vector<int> listGlyphCodes(const std::string &directory) {
+  std::vector<int> codes;
+  DIR *dir = opendir(directory.c_str());
+  if (dir == NULL) return codes;
+  while (struct dirent *entry = readdir(dir)) {
+    int code;
+    char rest;
+    if (sscanf(entry->d_name, "gly_%d%c", &code, &rest) == 1) codes.push_back(code);
+  }
+  closedir(dir);
+  return codes;
+}
+
+// Whether code is in ranges ("32-126,160-255"); an empty list takes all.
+inline bool inCodeRanges(int code, const std::string &ranges) {
+  if (ranges.empty()) return true;
+  for (const char *p = ranges.c_str(); *p;) {
+    char *end;
+    long first = std::strtol(p, &end, 10), last = first;
+    if (*end == '-') last = std::strtol(end + 1, &end, 10);
+    if (code >= first && code <= last) return true;
+    p = *end == ',' ? end + 1 : end;
+    if (end == p && *p) p++;
+  }
+  return false;
+}
+
+// Sparse map from code point to a dense glyph index, for the full Unicode
+// range. A directory indexed by the code point's high bits points at
+// 256-entry pages of indices; only pages that hold a glyph are allocated and
+// every other directory slot shares page 0, which is all misses. Lookup is
+// two loads and no hashing.
+class GlyphTable {
+  std::vector<int32_t> pages;         // 256 indices per page, -1 for none
+  std::vector<uint16_t> directory;    // page per code point >> 8
+
+public:
+  static const int MAX_CODE = 0x10FFFF;
+
+  GlyphTable() : pages(256, -1), directory((MAX_CODE >> 8) + 1, 0) {}
+
+  void insert(int code, int32_t index) {
+    if (code < 0 || code > MAX_CODE) return;
+    uint16_t &page = directory[code >> 8];
+    if (page == 0) {
+      page = pages.size() / 256;
+      pages.resize(pages.size() + 256, -1);
+    }
+    pages[page * 256 + (code & 255)] = index;
+  }
+
+  // Index of code, or -1.
+  int32_t find(int code) const {
+    if ((unsigned)code > (unsigned)MAX_CODE) return -1;
+    return pages[directory[code >> 8] * 256 + (code & 255)];
+  }
+
+  size_t pageCount() const { return pages.size() / 256 - 1; }
+};
+
+// Parse-once cache of glyph outlines keyed by code point. The set of
+// available glyphs is fixed at construction, from a font compiled into the
+// program, a packed font file if one is available, or else the directory
+// listing, and indexed by a GlyphTable. Glyphs are served straight from the
+// program's data or the pack's mapping, or read from their file the first
+// time they are requested, when their metrics are measured too. Code
+// points with no glyph get the fallback glyph.
+//
+// preloadAsync() reads glyphs on a thread pool instead. Each glyph has an
+// atomic state; a worker claims it, fills in its outline and metrics, and
+// publishes it with a release store, so the thread drawing never takes a
+// lock and never waits: a glyph a worker has claimed but not published
+// comes back empty and counts as skipped, any other is read as usual, and
+// generation() moves on as glyphs arrive.
+class GlyphCache {
+  enum { GLYPH_ABSENT, GLYPH_CLAIMED, GLYPH_READY };
+
+  std::string path;
+  const EmbeddedFont *embedded;
+  FontPack pack;
+  OutlineParser parser;
+  GlyphTable table;
+  std::vector<int> codes;             // code point of each index
+  std::vector<Outline> parsed;        // by index, when reading files
+  std::vector<OutlineView> views;     // by index
+  std::vector<GlyphMetrics> measured; // by index
+  std::unique_ptr<std::atomic<unsigned char>[]> state;   // by index
+  int32_t fallback;
+  std::atomic<size_t> pending;        // preload tasks not finished
+  std::atomic<unsigned long> arrived;
+  mutable std::mutex preloadMutex;    // guards the last decrement of pending
+  mutable std::condition_variable preloadDone;
+
+  // Held by a preload task; finishes the task when the pool destroys it,
+  // whether the task ran or the pool was destroyed with it still queued.
+  struct PreloadTicket {
+    GlyphCache *cache;
+    ~PreloadTicket() {
+      std::lock_guard<std::mutex> lock(cache->preloadMutex);
+      if (--cache->pending == 0) cache->preloadDone.notify_all();
+    }
+  };
+
+  // Index of the glyph drawn for code, or -1 if there is none.
+  int32_t find(int code) const {
+    int32_t index = table.find(code);
+    return index < 0 ? fallback : index;
+  }
+
+  // Reads glyph index into views and measured, through reader. Only the
+  // thread that claimed the glyph may call this.
+  void fill(int32_t index, OutlineParser &reader) {
+    OutlineView &view = views[index];
+    if (embedded) {
+      const EmbeddedGlyph &glyph = embedded->glyphs[index];
+      view.commands = embedded->commands + glyph.firstCommand;
+      view.commandCount = glyph.commandCount;
+      view.coords = embedded->coords + glyph.firstCoord;
+      view.coordCount = glyph.coordCount;
+      measured[index] = glyph.metrics;
+      return;
+    }
+    if (pack.isOpen()) {
+      const PackEntry &entry = pack.begin()[index];
+      view.commands = pack.commandsOf(entry);
+      view.commandCount = entry.commandCount;
+      view.coords = pack.coordsOf(entry);
+      view.coordCount = entry.coordCount;
+    } else {
+      Outline &outline = parsed[index];
+      std::string letterPath = path + std::to_string(codes[index]);
+      if (!reader.read(letterPath, outline)) {
+        std::cout << "Impossible to open the file, " << letterPath << std::endl;
+        std::cout << std::endl;
+      }
+      view.commands = outline.commands.data();
+      view.commandCount = outline.commands.size();
+      view.coords = outline.coords.data();
+      view.coordCount = outline.coords.size();
+    }
+    measured[index] = measureOutline(view);
+  }
+
+  // Claims glyph index for the calling thread. False if another has it.
+  bool claim(int32_t index) {
+    unsigned char absent = GLYPH_ABSENT;
+    return state[index].compare_exchange_strong(absent, GLYPH_CLAIMED, std::memory_order_acquire);
+  }
+
+  // Index that serves code, loading it on first use; -1 if there is none,
+  // or -2 if a preload worker is still filling it.
+  int32_t load(int code) {
+    int32_t index = table.find(code);
+    if (index < 0) {
+      fallbacks++;
+      index = fallback;
+      if (index < 0) return -1;
+    }
+    if (state[index].load(std::memory_order_acquire) == GLYPH_READY) {
+      hits++;
+      return index;
+    }
+    if (!claim(index)) {
+      skipped++;
+      return -2;
+    }
+
+    misses++;
+    fill(index, parser);
+    state[index].store(GLYPH_READY, std::memory_order_release);
+    return index;
+  }
+
+  // Indexes codes and sizes the per-glyph state, with parsedCount outlines
+  // to read files into.
+  void index(size_t parsedCount) {
+    hits = 0;
+    misses = 0;
+    fallbacks = 0;
+    skipped = 0;
+    pending = 0;
+    arrived = 0;
+    for (size_t i = 0; i < codes.size(); i++) table.insert(codes[i], i);
+    parsed.resize(parsedCount);
+    views.resize(codes.size());
+    measured.resize(codes.size());
+    state.reset(new std::atomic<unsigned char>[codes.size()]);
+    for (size_t i = 0; i < codes.size(); i++) state[i].store(GLYPH_ABSENT, std::memory_order_relaxed);
+    fallback = table.find(FALLBACK_CODE);
+  }
+
+public:
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long fallbacks;   // requests for code points with no glyph
+  unsigned long skipped;     // requests for glyphs a preload had not published
+
+  static const int FALLBACK_CODE = '?';
+
+  GlyphCache(std::string directory = "cmuntt/", std::string packPath = "cmuntt.pack") : embedded(0) {
+    path = directory + "gly_";
+
+    if (pack.open(packPath)) {
+      for (const PackEntry *e = pack.begin(); e != pack.end(); e++) codes.push_back(e->code);
+    } else {
+      if (!packPath.empty() && access(packPath.c_str(), F_OK) == 0)
+        std::cout << "Ignoring " << packPath << ": damaged or from another version" << std::endl;
+      codes = listGlyphCodes(directory);
+      std::sort(codes.begin(), codes.end());
+      if (codes.empty()) std::cout << "No glyph files found in " << directory << std::endl;
+    }
+    index(pack.isOpen() ? 0 : codes.size());
+  }
+
+  // Serves the glyphs of a compiled-in font, which must outlive the cache.
+  // Touches no files.
+  explicit GlyphCache(const EmbeddedFont &font) : embedded(&font) {
+    for (size_t i = 0; i < font.glyphCount; i++) codes.push_back(font.glyphs[i].code);
+    index(0);
+  }
+  GlyphCache(const GlyphCache &) = delete;
+  GlyphCache &operator=(const GlyphCache &) = delete;
+
+  ~GlyphCache() { waitForPreload(); }
+
+  bool usingPack() const { return pack.isOpen(); }
+  bool usingEmbedded() const { return embedded != 0; }
+
+  bool contains(int code) const { return table.find(code) >= 0; }
+
+  // Every code point with a glyph, by index.
+  const std::vector<int> &codePoints() const { return codes; }
+
+  // Code point whose glyph is drawn for code: code itself, or the fallback.
+  int resolve(int code) const {
+    return table.find(code) >= 0 || fallback < 0 ? code : FALLBACK_CODE;
+  }
+
+  // Whether the glyph drawn for code can be served now. Loads nothing.
+  bool ready(int code) const {
+    int32_t index = find(code);
+    return index < 0 || state[index].load(std::memory_order_acquire) == GLYPH_READY;
+  }
+
+  // The outline drawn for code; empty if there is none or a preload has not
+  // published it yet.
+  OutlineView get(int code) {
+    int32_t index = load(code);
+    return index < 0 ? OutlineView() : views[index];
+  }
+
+  // Metrics of the glyph drawn for code, measured once when it is loaded;
+  // zero when get() would be empty.
+  GlyphMetrics metrics(int code) {
+    int32_t index = load(code);
+    return index < 0 ? GlyphMetrics() : measured[index];
+  }
+
+  // Loads every glyph used by the code points up front so later frames only
+  // hit.
+  void preload(const std::vector<int> &text) {
+    for (int c : text) {
+      int32_t index = find(c);
+      if (c != 32 && index >= 0 && state[index].load(std::memory_order_acquire) == GLYPH_ABSENT) get(c);
+    }
+  }
+
+  // Reads every glyph if all is set, or else the glyphs of the code points,
+  // on pool's threads, a batch of glyphs per task, and returns at once.
+  // Glyphs being read are skipped until they are published; the rest load
+  // on the calling thread as usual. onReady, if set, is called on a worker
+  // after each batch. The cache waits for the preload before it is
+  // destroyed; a pool destroyed first drops the batches it had not started.
+  void preloadAsync(ThreadPool &pool, bool all, const std::vector<int> &wanted = std::vector<int>(),
+                    std::function<void()> onReady = std::function<void()>()) {
+    std::vector<int32_t> indices;
+    if (all) {
+      for (size_t i = 0; i < codes.size(); i++) indices.push_back(i);
+    } else {
+      for (int c : wanted) {
+        int32_t index = find(c);
+        if (index >= 0) indices.push_back(index);
+      }
+    }
+
+    const size_t batch = 16;
+    size_t tasks = (indices.size() + batch - 1) / batch;
+    pending += tasks;
+    std::shared_ptr<std::vector<int32_t> > shared(new std::vector<int32_t>(std::move(indices)));
+    for (size_t t = 0; t < tasks; t++) {
+      std::shared_ptr<PreloadTicket> ticket(new PreloadTicket{this});
+      pool.submit([this, shared, t, batch, onReady, ticket] {
+        OutlineParser reader;
+        size_t end = std::min(shared->size(), (t + 1) * batch);
+        for (size_t i = t * batch; i < end; i++) {
+          int32_t index = (*shared)[i];
+          if (!claim(index)) continue;
+          fill(index, reader);
+          state[index].store(GLYPH_READY, std::memory_order_release);
+        }
+        arrived++;
+        if (onReady) onReady();
+      });
+    }
+  }
+
+  bool preloading() const { return pending.load(std::memory_order_acquire) > 0; }
+
+  // Blocks until every preload task has finished.
+  void waitForPreload() const {
+    std::unique_lock<std::mutex> lock(preloadMutex);
+    preloadDone.wait(lock, [this] { return !preloading(); });
+  }
+
+  // Changes whenever preloaded glyphs are published.
+  unsigned long generation() const { return arrived.load(std::memory_order_acquire); }
+
+  size_t size() const { return codes.size(); }
+};
+
+#endif
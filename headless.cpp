@@ -0,0 +1,125 @@
+// ==========================================================================
+// headless: renders text without a GPU using the software rasterizer
+//
+// Usage:  headless [-fill] [-threads N] [-size WxH] [-wrap columns]
+//                  [-o out.png|out.ppm] [text]
+//         headless [-fill] [-size WxH] [-scroll lines] -file path
+//         headless -bench [-fill] [-frames N] [text]
+//
+// Uses the window's default zoom and pan. -file renders the part of a text
+// file on screen after scrolling down, as boilerplate -file does. -bench renders the text (default:
+// the pangram) at 768x768 repeatedly and reports frames/s per thread count.
+// ==========================================================================
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+#include "glyphs.h"
+#include "loader.h"
+#include "raster.h"
+#include "threadpool.h"
+
+using std::string;
+using std::vector;
+using std::cerr;
+using std::endl;
+
+typedef std::chrono::steady_clock Clock;
+
+void benchThreads(const vector<float> &patches, float scale, bool fill, int frames) {
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  vector<unsigned> counts;
+  for (unsigned t = 1; t < cores; t *= 2) counts.push_back(t);
+  counts.push_back(cores);
+
+  printf("headless: %zu patches at 768x768, %s, %d frames, %u cores\n",
+         patches.size() / PATCH_FLOATS, fill ? "filled" : "outlines", frames, cores);
+  double single = 0.0;
+  for (unsigned threads : counts) {
+    ThreadPool pool(threads);
+    SoftwareRasterizer rasterizer(768, 768);
+    rasterizer.fill = fill;
+    Image image;
+    rasterizer.render(patches, scale, 0.0f, pool, image);   // warm up
+
+    Clock::time_point start = Clock::now();
+    for (int f = 0; f < frames; f++) rasterizer.render(patches, scale, 0.0f, pool, image);
+    double fps = frames / std::chrono::duration<double>(Clock::now() - start).count();
+    if (threads == 1) single = fps;
+    printf("  %2u threads  %8.1f frames/s  %5.2fx\n", threads, fps, fps / single);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  string text = "The quick brown fox jumps over the lazy dog";
+  string output = "headless.png";
+  string file;
+  bool fill = false, bench = false;
+  unsigned threads = 0;
+  int width = 768, height = 768, frames = 100, columns = 0;
+  float scrollLines = 0.0f;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-fill") fill = true;
+    else if (arg == "-bench") bench = true;
+    else if (arg == "-threads" && i + 1 < argc) threads = atoi(argv[++i]);
+    else if (arg == "-frames" && i + 1 < argc) frames = atoi(argv[++i]);
+    else if (arg == "-wrap" && i + 1 < argc) columns = atoi(argv[++i]);
+    else if (arg == "-scroll" && i + 1 < argc) scrollLines = atof(argv[++i]);
+    else if (arg == "-file" && i + 1 < argc) file = argv[++i];
+    else if (arg == "-o" && i + 1 < argc) output = argv[++i];
+    else if (arg == "-size" && i + 1 < argc) sscanf(argv[++i], "%dx%d", &width, &height);
+    else text = arg;
+  }
+
+  GlyphCache glyphs;
+  LayoutEngine layouts(glyphs);
+  vector<float> patches;
+  float scale;
+  if (file.empty()) {
+    Loader loader(text, layouts, columns * layouts.spaceAdvance);
+    loader.build(patches);
+    scale = 3.0f / loader.textLength();   // the window's scalingFactor
+  } else {
+    Document document(layouts);
+    if (!document.open(file)) {
+      cerr << "Impossible to open the file, " << file << endl;
+      return 1;
+    }
+    scale = 3.0f / 80;   // boilerplate's zoom for documents
+    float scroll = scrollLines * layouts.lineHeight;
+    float view[4] = { 0.0f, -1.0f / scale - scroll, 2.0f / scale, 1.0f / scale - scroll };
+    TextLayout visible;
+    document.visible(view, visible);
+    for (const GlyphPlacement &placement : visible.glyphs)
+      Loader::appendPatches(glyphs.get(placement.code), placement.x, placement.y + scroll, patches);
+    printf("headless: %zu of %zu chunks visible, %zu glyphs\n",
+           document.visibleChunks().size(), document.chunkCount(), visible.glyphs.size());
+  }
+
+  if (bench) {
+    benchThreads(patches, scale, fill, frames);
+    return 0;
+  }
+
+  ThreadPool pool(threads);
+  SoftwareRasterizer rasterizer(width, height);
+  rasterizer.fill = fill;
+  Image image;
+  rasterizer.render(patches, scale, 0.0f, pool, image);
+
+  bool ppm = output.size() > 4 && output.compare(output.size() - 4, 4, ".ppm") == 0;
+  if (!(ppm ? writePPM(image, output) : writePNG(image, output))) {
+    cerr << "Impossible to write the file, " << output << endl;
+    return 1;
+  }
+  return 0;
+}
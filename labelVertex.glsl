@@ -0,0 +1,21 @@
+#version 410
+
+layout(location = 0) in vec2 position;   // glyph space, in 16-bit steps
+layout(location = 1) in vec3 instance;   // pen x and y in the label, label slot
+
+// Two texels per label slot: x, y, scale and 0, then the colour
+uniform samplerBuffer labels;
+uniform float quantum;                   // glyph units per 16-bit step
+
+uniform mat4x4 S;
+uniform mat4x4 T;
+
+out vec4 colour;
+
+void main() {
+  int slot = int(instance.z);
+  vec4 transform = texelFetch(labels, 2 * slot);
+  colour = texelFetch(labels, 2 * slot + 1);
+  vec2 p = transform.xy + transform.z * (position * quantum + instance.xy);
+  gl_Position = S * T * vec4(p, 0.0, 1.0);
+}
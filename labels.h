@@ -0,0 +1,311 @@
+// ==========================================================================
+// Batched text labels
+//
+// Many independent strings, each with its own position, scale and colour,
+// drawn together. A label's transform and colour live in a slot of a
+// texture buffer that labelVertex.glsl reads, and its characters are
+// instances in a GlyphGeometry's instance buffer that name the slot. The
+// instances are kept in one region per glyph, so every label is drawn by
+// that glyph's instanced draws: the draw count follows the glyphs in use,
+// never the number of labels.
+//
+// Moving or recolouring a label rewrites its 32-byte slot. Adding one
+// writes its characters at the ends of their glyphs' regions, and removing
+// one fills each of its instances with the last of the region, so neither
+// touches the other labels' data beyond that. A region that fills up moves
+// to the end of the buffer with twice the room, copied on the GPU. Changes
+// are kept on the CPU and uploaded by the next draw(), runs of neighbours
+// in one call.
+// ==========================================================================
+
+#ifndef LABELS_H
+#define LABELS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "glbackend.h"
+#include "glyphgeometry.h"
+#include "layout.h"
+
+class LabelBatch {
+  struct Character {
+    int code;
+    size_t index;   // instance within its glyph's region
+  };
+  struct Label {
+    std::vector<Character> characters;
+    bool used;
+    bool dirty;     // slot not uploaded yet
+  };
+  // Room for the instances of one glyph, used from the start.
+  struct Region {
+    size_t first;
+    size_t capacity;
+    std::vector<std::pair<uint32_t, uint32_t> > owners;   // label slot and character of each instance
+    std::vector<uint32_t> dirty;                          // instances not uploaded yet
+  };
+
+  static const size_t SLOT_FLOATS = 8;        // x, y, scale, 0, r, g, b, a
+  static const size_t INSTANCE_FLOATS = 3;    // pen x, pen y, slot
+
+  LayoutEngine *layouts;
+  GLBackend *gl;
+  std::vector<Label> labels;
+  std::vector<uint32_t> freeSlots;
+  std::vector<uint32_t> dirtySlots;
+  std::vector<float> slots;                   // copy of the slot buffer
+  size_t slotCapacity;                        // slots the buffer has room for
+  GLuint slotBuffer;
+  GLuint slotTexture;
+  std::unordered_map<int, Region> regions;    // by code point
+  std::vector<int> dirtyRegions;
+  std::vector<float> instances;               // copy of the instance buffer
+  size_t allocated;                           // instances handed to regions
+  std::vector<GlyphGeometry::Batch> batches;
+  bool batchesDirty;
+  size_t live;
+
+  void touchSlot(uint32_t slot) {
+    if (labels[slot].dirty) return;
+    labels[slot].dirty = true;
+    dirtySlots.push_back(slot);
+  }
+
+  void touchInstance(int code, Region &region, size_t index) {
+    if (region.dirty.empty()) dirtyRegions.push_back(code);
+    region.dirty.push_back(index);
+  }
+
+  size_t allocate(size_t count) {
+    size_t first = allocated;
+    allocated += count;
+    instances.resize(allocated * INSTANCE_FLOATS);
+    return first;
+  }
+
+  // code's region with room for one more instance.
+  Region &regionWithRoom(int code) {
+    auto found = regions.find(code);
+    if (found == regions.end()) {
+      Region region = { allocate(4), 4, {}, {} };
+      found = regions.insert(std::make_pair(code, region)).first;
+    }
+    Region &region = found->second;
+    if (region.owners.size() == region.capacity) {
+      size_t first = allocate(2 * region.capacity);
+      std::copy(instances.begin() + region.first * INSTANCE_FLOATS,
+                instances.begin() + (region.first + region.capacity) * INSTANCE_FLOATS,
+                instances.begin() + first * INSTANCE_FLOATS);
+      // Moved on the GPU; instances not uploaded yet still go from the copy
+      geometry.va.copyBuffer("instances", region.first * INSTANCE_FLOATS, first * INSTANCE_FLOATS,
+                             region.owners.size() * INSTANCE_FLOATS);
+      region.first = first;
+      region.capacity *= 2;
+    }
+    return region;
+  }
+
+  // Lays text out into slot's instances.
+  void place(uint32_t slot, const std::string &text) {
+    const TextLayout &layout = layouts->layout(text);
+    geometry.addGlyphs(layout);
+    Label &label = labels[slot];
+    for (const GlyphPlacement &p : layout.glyphs) {
+      const GlyphGeometry::Range *range = geometry.range(p.code);
+      if (!range || range->empty()) continue;
+      Region &region = regionWithRoom(p.code);
+      size_t index = region.owners.size();
+      float *instance = &instances[(region.first + index) * INSTANCE_FLOATS];
+      instance[0] = p.x;
+      instance[1] = p.y;
+      instance[2] = slot;
+      region.owners.push_back(std::make_pair(slot, (uint32_t)label.characters.size()));
+      touchInstance(p.code, region, index);
+      Character character = { p.code, index };
+      label.characters.push_back(character);
+    }
+    batchesDirty = true;
+  }
+
+  // Takes slot's instances out, filling each hole with its region's last.
+  void unplace(uint32_t slot) {
+    for (size_t k = 0; k < labels[slot].characters.size(); k++) {
+      const Character &character = labels[slot].characters[k];
+      Region &region = regions[character.code];
+      size_t last = region.owners.size() - 1;
+      if (character.index != last) {
+        std::copy(instances.begin() + (region.first + last) * INSTANCE_FLOATS,
+                  instances.begin() + (region.first + last + 1) * INSTANCE_FLOATS,
+                  instances.begin() + (region.first + character.index) * INSTANCE_FLOATS);
+        std::pair<uint32_t, uint32_t> owner = region.owners[last];
+        region.owners[character.index] = owner;
+        labels[owner.first].characters[owner.second].index = character.index;
+        touchInstance(character.code, region, character.index);
+      }
+      region.owners.pop_back();
+    }
+    labels[slot].characters.clear();
+    batchesDirty = true;
+  }
+
+  void uploadSlots() {
+    if (slots.size() > slotCapacity * SLOT_FLOATS) {
+      // Regrown storage starts from the copy, so everything goes at once
+      slotCapacity = std::max<size_t>(slotCapacity, 64);
+      while (slotCapacity * SLOT_FLOATS < slots.size()) slotCapacity *= 2;
+      gl->bindBuffer(GL_TEXTURE_BUFFER, slotBuffer);
+      gl->bufferData(GL_TEXTURE_BUFFER, slotCapacity * SLOT_FLOATS * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+      gl->bufferSubData(GL_TEXTURE_BUFFER, 0, slots.size() * sizeof(float), slots.data());
+      gl->bindBuffer(GL_TEXTURE_BUFFER, 0);
+      gl->bindTexture(GL_TEXTURE_BUFFER, slotTexture);
+      gl->texBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, slotBuffer);
+      gl->bindTexture(GL_TEXTURE_BUFFER, 0);
+      for (uint32_t slot : dirtySlots) labels[slot].dirty = false;
+      dirtySlots.clear();
+      return;
+    }
+    if (dirtySlots.empty()) return;
+    std::sort(dirtySlots.begin(), dirtySlots.end());
+    gl->bindBuffer(GL_TEXTURE_BUFFER, slotBuffer);
+    for (size_t i = 0; i < dirtySlots.size();) {
+      size_t j = i + 1;
+      while (j < dirtySlots.size() && dirtySlots[j] == dirtySlots[j - 1] + 1) j++;
+      gl->bufferSubData(GL_TEXTURE_BUFFER, dirtySlots[i] * SLOT_FLOATS * sizeof(float),
+                        (j - i) * SLOT_FLOATS * sizeof(float), &slots[dirtySlots[i] * SLOT_FLOATS]);
+      i = j;
+    }
+    gl->bindBuffer(GL_TEXTURE_BUFFER, 0);
+    for (uint32_t slot : dirtySlots) labels[slot].dirty = false;
+    dirtySlots.clear();
+  }
+
+  void uploadInstances() {
+    for (int code : dirtyRegions) {
+      Region &region = regions[code];
+      std::vector<uint32_t> &dirty = region.dirty;
+      std::sort(dirty.begin(), dirty.end());
+      dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+      // Instances past the end were removed since
+      dirty.erase(std::lower_bound(dirty.begin(), dirty.end(), region.owners.size()), dirty.end());
+      for (size_t i = 0; i < dirty.size();) {
+        size_t j = i + 1;
+        while (j < dirty.size() && dirty[j] == dirty[j - 1] + 1) j++;
+        size_t first = (region.first + dirty[i]) * INSTANCE_FLOATS;
+        geometry.va.updateBuffer("instances", first, &instances[first], (j - i) * INSTANCE_FLOATS);
+        i = j;
+      }
+      dirty.clear();
+    }
+    dirtyRegions.clear();
+  }
+
+public:
+  // Glyph geometry the labels are drawn with; its instances are the labels'.
+  GlyphGeometry geometry;
+
+  // filled draws the labels' glyphs filled, as GlyphGeometry does.
+  explicit LabelBatch(LayoutEngine &engine, bool filled = false)
+    : layouts(&engine), gl(&glBackend()), slotCapacity(0), allocated(0), batchesDirty(false), live(0),
+      geometry(engine.cache(), filled) {
+    slotBuffer = gl->genBuffer();
+    slotTexture = gl->genTexture();
+  }
+
+  LabelBatch(const LabelBatch &) = delete;
+  LabelBatch &operator=(const LabelBatch &) = delete;
+
+  ~LabelBatch() {
+    gl->deleteTexture(slotTexture);
+    gl->deleteBuffer(slotBuffer);
+  }
+
+  // Adds a label showing text, its first baseline starting at (x, y) and
+  // its glyph units scaled by scale, in the space the view transform maps
+  // to the screen. colour is r, g, b, a. Returns the label's slot. Glyphs
+  // a preload has not published yet are left out of it.
+  uint32_t add(const std::string &text, float x, float y, float scale, const float colour[4]) {
+    uint32_t slot;
+    if (!freeSlots.empty()) {
+      slot = freeSlots.back();
+      freeSlots.pop_back();
+    } else {
+      slot = labels.size();
+      labels.push_back(Label());
+      labels.back().dirty = false;
+      slots.resize(labels.size() * SLOT_FLOATS);
+    }
+    labels[slot].used = true;
+    live++;
+    move(slot, x, y, scale);
+    setColour(slot, colour);
+    place(slot, text);
+    return slot;
+  }
+
+  void move(uint32_t slot, float x, float y, float scale) {
+    float *s = &slots[slot * SLOT_FLOATS];
+    s[0] = x;
+    s[1] = y;
+    s[2] = scale;
+    s[3] = 0.0f;
+    touchSlot(slot);
+  }
+
+  void setColour(uint32_t slot, const float colour[4]) {
+    std::copy(colour, colour + 4, &slots[slot * SLOT_FLOATS + 4]);
+    touchSlot(slot);
+  }
+
+  // Replaces slot's text, keeping its transform and colour.
+  void setText(uint32_t slot, const std::string &text) {
+    unplace(slot);
+    place(slot, text);
+  }
+
+  // Frees slot for a later add().
+  void remove(uint32_t slot) {
+    unplace(slot);
+    labels[slot].used = false;
+    freeSlots.push_back(slot);
+    live--;
+  }
+
+  // Uploads what changed and draws every label, as GlyphGeometry::draw()
+  // does. The program must be in use with its "labels" sampler on texture
+  // unit 0.
+  void draw() {
+    uploadSlots();
+    uploadInstances();
+    if (batchesDirty) {
+      batches.clear();
+      for (const auto &entry : regions) {
+        if (entry.second.owners.empty()) continue;
+        GlyphGeometry::Batch batch = { *geometry.range(entry.first), entry.second.first,
+                                       (GLsizei)entry.second.owners.size() };
+        batches.push_back(batch);
+      }
+      batchesDirty = false;
+    }
+    gl->activeTexture(GL_TEXTURE0);
+    gl->bindTexture(GL_TEXTURE_BUFFER, slotTexture);
+    geometry.draw(batches);
+    gl->bindTexture(GL_TEXTURE_BUFFER, 0);
+  }
+
+  size_t size() const { return live; }
+  size_t drawCount() const { return GlyphGeometry::drawCount(batches); }
+
+  // Characters drawn, over every label.
+  size_t instanceCount() const {
+    size_t count = 0;
+    for (const auto &entry : regions) count += entry.second.owners.size();
+    return count;
+  }
+};
+
+#endif
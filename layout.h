@@ -0,0 +1,203 @@
+// ==========================================================================
+// Text layout
+//
+// Turns a string into glyph placements: pen positions advanced by the glyph
+// metrics, lines broken at '\n' (so "\r\n" is one break; '\r' is never
+// drawn) and, given a wrap width, words wrapped greedily to it. Spaces and
+// tabs separate words. Layouts are cached by (text, wrap width), so one is
+// only recomputed when the text or the width changes; a caller that asks
+// for the same text every frame keeps a LayoutHandle to find it without
+// comparing the text.
+// ==========================================================================
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "glyphs.h"
+#include "utf8.h"
+
+// One glyph to draw: the glyph's code point (after fallback) and its pen
+// position on the baseline, in glyph units.
+struct GlyphPlacement {
+  int code;
+  float x;
+  float y;
+};
+
+// Where a caller's layout sits in a LayoutEngine's cache. Only valid for
+// the text and wrap width it was first used with.
+struct LayoutHandle {
+  size_t entry;
+  unsigned long id;
+
+  LayoutHandle() : entry(0), id(0) {}
+};
+
+struct TextLayout {
+  std::vector<GlyphPlacement> glyphs;
+  int lines;
+  int longestLine;   // in code points
+  float width;       // of the widest line, in glyph units
+};
+
+class LayoutEngine {
+  struct Entry {
+    std::string text;
+    float wrapWidth;
+    TextLayout layout;
+    unsigned long lastUse;
+    unsigned long id;   // the use it was laid out on, so unique
+  };
+
+  GlyphCache *glyphs;
+  std::vector<Entry> entries;
+  unsigned long uses;
+  std::vector<int> codes;
+  std::vector<float> advances;
+
+  static bool whitespace(int c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+  void compute(const std::string &text, float wrapWidth, TextLayout &layout) {
+    decodeUTF8(text, codes);
+    advances.resize(codes.size());
+    for (size_t i = 0; i < codes.size(); i++) advances[i] = advance(codes[i]);
+
+    layout.glyphs.clear();
+    layout.lines = 1;
+    layout.longestLine = 0;
+    layout.width = 0.0f;
+    float x = 0.0f, y = 0.0f;
+    int column = 0;
+    auto newLine = [&] {
+      layout.width = std::max(layout.width, x);
+      layout.longestLine = std::max(layout.longestLine, column);
+      layout.lines++;
+      x = 0.0f;
+      y -= lineHeight;
+      column = 0;
+    };
+
+    size_t i = 0;
+    while (i < codes.size()) {
+      if (codes[i] == '\n') {
+        newLine();
+        i++;
+        continue;
+      }
+      if (codes[i] == '\r') {
+        i++;
+        continue;
+      }
+      if (codes[i] == ' ' || codes[i] == '\t') {
+        x += advances[i++];
+        column++;
+        continue;
+      }
+
+      // A word moves to the next line whole if it fits there, and is broken
+      // between glyphs only if it is wider than a line.
+      size_t end = i;
+      float width = 0.0f;
+      for (; end < codes.size() && !whitespace(codes[end]); end++) width += advances[end];
+      bool wrap = wrapWidth > 0.0f;
+      if (wrap && x > 0.0f && x + width > wrapWidth) newLine();
+      for (; i < end; i++) {
+        if (wrap && width > wrapWidth && x > 0.0f && x + advances[i] > wrapWidth) newLine();
+        GlyphPlacement placement = { glyphs->resolve(codes[i]), x, y };
+        layout.glyphs.push_back(placement);
+        x += advances[i];
+        column++;
+      }
+    }
+    layout.width = std::max(layout.width, x);
+    layout.longestLine = std::max(layout.longestLine, column);
+  }
+
+  // The cached entry for (text, wrapWidth), laid out now if there is none.
+  Entry &lookup(const std::string &text, float wrapWidth) {
+    uses++;
+    for (Entry &entry : entries) {
+      if (entry.wrapWidth == wrapWidth && entry.text == text) {
+        hits++;
+        entry.lastUse = uses;
+        return entry;
+      }
+    }
+
+    misses++;
+    Entry *entry;
+    if (entries.size() < capacity) {
+      entries.push_back(Entry());
+      entry = &entries.back();
+    } else {
+      entry = &*std::min_element(entries.begin(), entries.end(),
+                                 [](const Entry &a, const Entry &b) { return a.lastUse < b.lastUse; });
+    }
+    entry->text = text;
+    entry->wrapWidth = wrapWidth;
+    entry->lastUse = uses;
+    entry->id = uses;
+    compute(text, wrapWidth, entry->layout);
+    return *entry;
+  }
+
+public:
+  float lineHeight;     // baseline to baseline, in glyph units
+  float spaceAdvance;   // the font has no space glyph
+  int tabSpaces;        // a tab's advance, in spaces
+  size_t capacity;      // layouts kept; the least recently used goes first
+  unsigned long hits;
+  unsigned long misses;
+
+  explicit LayoutEngine(GlyphCache &cache, size_t capacity = 16)
+    : glyphs(&cache), uses(0), lineHeight(1.2f), tabSpaces(4), capacity(std::max<size_t>(capacity, 1)), hits(0), misses(0) {
+    spaceAdvance = cache.contains('n') ? cache.metrics('n').advance : 0.5f;
+    entries.reserve(this->capacity);
+  }
+
+  GlyphCache &cache() { return *glyphs; }
+
+  // Pen movement after code point c. A glyph a preload has not published
+  // yet holds a space's place until it arrives.
+  float advance(int c) {
+    if (c == ' ') return spaceAdvance;
+    if (c == '\t') return tabSpaces * spaceAdvance;
+    if (c == '\n' || c == '\r') return 0.0f;
+    float a = glyphs->metrics(c).advance;
+    return glyphs->ready(c) ? a : spaceAdvance;
+  }
+
+  // Layout of text wrapped to wrapWidth glyph units, or unwrapped if
+  // wrapWidth is 0. The reference stays valid until the next call.
+  const TextLayout &layout(const std::string &text, float wrapWidth = 0.0f) {
+    return lookup(text, wrapWidth).layout;
+  }
+
+  // As above, through handle: while the entry handle last found is still
+  // cached, a hit costs nothing however long the text is. handle must only
+  // ever be used with this text and wrap width.
+  const TextLayout &layout(const std::string &text, float wrapWidth, LayoutHandle &handle) {
+    if (handle.entry < entries.size() && entries[handle.entry].id == handle.id) {
+      Entry &entry = entries[handle.entry];
+      hits++;
+      entry.lastUse = ++uses;
+      return entry.layout;
+    }
+    Entry &entry = lookup(text, wrapWidth);
+    handle.entry = &entry - entries.data();
+    handle.id = entry.id;
+    return entry.layout;
+  }
+
+  // Lays text out into out, outside the cache, for text that changes too
+  // often to be worth keeping there. out's storage is reused.
+  void layout(const std::string &text, float wrapWidth, TextLayout &out) { compute(text, wrapWidth, out); }
+
+  void clear() { entries.clear(); }
+};
+
+#endif
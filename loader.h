@@ -0,0 +1,194 @@
+// ==========================================================================
+// Loader: turns a string into a stream of cubic Bezier patches
+//
+// Every glyph outline is expanded into 4-point patches (8 floats each) that
+// the tessellation shaders draw as isolines. L and Z records are promoted to
+// cubics with control points at 1/4 and 3/4 of the segment. Glyph positions
+// come from a LayoutEngine: the string is UTF-8 and may span several lines,
+// and code points the font lacks are drawn with its fallback glyph.
+// ==========================================================================
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glyphs.h"
+#include "globjects.h"
+#include "layout.h"
+
+class Loader {
+  std::string text;
+  float wrapWidth;
+  LayoutEngine *layouts;
+  GlyphCache *glyphs;
+  std::vector<float> scratch;   // patches for load(VertexArray &)
+  std::vector<OutlineView> outlines;   // of each placement, in build()
+  LayoutHandle handle;            // of text in layouts
+
+public:
+  // wrapWidth is in glyph units; 0 breaks lines only at newlines.
+  Loader(std::string textToDisplay, LayoutEngine &engine, float wrap = 0.0f){
+      text = std::move(textToDisplay);
+      wrapWidth = wrap;
+      layouts = &engine;
+      glyphs = &engine.cache();
+      layout();
+  }
+
+  // Glyph placements, laid out on first use and cached by the engine.
+  const TextLayout &layout() { return layouts->layout(text, wrapWidth, handle); }
+
+  // Code points on the longest line, which sets the default zoom.
+  int textLength() { return layout().longestLine; }
+
+  // Patches appendPatches() makes of outline: one per segment.
+  static size_t patchCount(const OutlineView &outline) {
+    size_t count = 0;
+    for (size_t i = 0; i < outline.commandCount; i++) count += outline.commands[i] != 'M';
+    return count;
+  }
+
+  // Writes the patches of one glyph outline with its pen position at
+  // (x, y) to out, which has room for patchCount(outline) of them. Returns
+  // the end of what it wrote.
+  static float *writePatches(const OutlineView &outline, float x, float y, float *out) {
+    float startPos[2] = {};
+
+    float previousEndPoint[2] = {};
+
+    const float *c = outline.coords;
+
+    for (size_t i = 0; i < outline.commandCount; i++) {
+      char lineType = outline.commands[i];
+      if (lineType == 'M') {
+        float coords[2] = { c[0] + x, c[1] + y };
+        c += 2;
+
+        startPos[0] = coords[0];
+        startPos[1] = coords[1];
+        previousEndPoint[0] = coords[0];
+        previousEndPoint[1] = coords[1];
+      } else if (lineType == 'C') {
+        float point1[2] = { c[0] + x, c[1] + y };
+        float point2[2] = { c[2] + x, c[3] + y };
+        float point3[2] = { c[4] + x, c[5] + y };
+        c += 6;
+
+        *out++ = previousEndPoint[0];
+        *out++ = previousEndPoint[1];
+        *out++ = point1[0];
+        *out++ = point1[1];
+        *out++ = point2[0];
+        *out++ = point2[1];
+        *out++ = point3[0];
+        *out++ = point3[1];
+
+        previousEndPoint[0] = point3[0];
+        previousEndPoint[1] = point3[1];
+      } else if (lineType == 'L') {
+        float point0[2] = {};
+        point0[0] = previousEndPoint[0];
+        point0[1] = previousEndPoint[1];
+        float point1[2] = { c[0] + x, c[1] + y };
+        c += 2;
+
+        float middle1[2] = {};
+        float middle2[2] = {};
+
+        middle1[0] = point0[0] * 0.75 + point1[0] * 0.25;
+        middle1[1] = point0[1] * 0.75 + point1[1] * 0.25;
+
+        middle2[0] = point0[0] * 0.25 + point1[0] * 0.75;
+        middle2[1] = point0[1] * 0.25 + point1[1] * 0.75;
+
+        *out++ = point0[0];
+        *out++ = point0[1];
+        *out++ = middle1[0];
+        *out++ = middle1[1];
+        *out++ = middle2[0];
+        *out++ = middle2[1];
+        *out++ = point1[0];
+        *out++ = point1[1];
+
+        previousEndPoint[0] = point1[0];
+        previousEndPoint[1] = point1[1];
+      }
+      else if (lineType == 'Z') {
+        float point0[2] = {};
+        point0[0] = previousEndPoint[0];
+        point0[1] = previousEndPoint[1];
+        float point1[2] = {};
+        point1[0] = startPos[0];
+        point1[1] = startPos[1];
+
+        float middle1[2] = {};
+        float middle2[2] = {};
+
+        middle1[0] = point0[0] * 0.75 + point1[0] * 0.25;
+        middle1[1] = point0[1] * 0.75 + point1[1] * 0.25;
+
+        middle2[0] = point0[0] * 0.25 + point1[0] * 0.75;
+        middle2[1] = point0[1] * 0.25 + point1[1] * 0.75;
+
+        *out++ = point0[0];
+        *out++ = point0[1];
+        *out++ = middle1[0];
+        *out++ = middle1[1];
+        *out++ = middle2[0];
+        *out++ = middle2[1];
+        *out++ = point1[0];
+        *out++ = point1[1];
+      }
+    }
+    return out;
+  }
+
+  // Appends the patches of one glyph outline with its pen position at
+  // (x, y).
+  static void appendPatches(const OutlineView &outline, float x, float y, std::vector<float> &points) {
+    size_t size = points.size();
+    points.resize(size + patchCount(outline) * 8);
+    writePatches(outline, x, y, points.data() + size);
+  }
+
+  // Builds the patches for the whole string in layout space: glyph units,
+  // with the first glyph's pen position at the origin and later lines below
+  // it. Zoom and pan are applied on the GPU by the S and T uniforms, so this
+  // only has to run when the text changes. points is replaced, sized from
+  // the glyphs' segment counts so it grows at most once.
+  void build(std::vector<float> &points) {
+    const std::vector<GlyphPlacement> &placed = layout().glyphs;
+    outlines.resize(placed.size());
+    size_t patches = 0;
+    for (size_t i = 0; i < placed.size(); i++) {
+      outlines[i] = glyphs->get(placed[i].code);
+      patches += patchCount(outlines[i]);
+    }
+
+    points.resize(patches * 8);
+    float *out = points.data();
+    for (size_t i = 0; i < placed.size(); i++) out = writePatches(outlines[i], placed[i].x, placed[i].y, out);
+  }
+
+  // Returns a new vertex array holding the patches.
+  VertexArray load() {
+    std::vector<float> points;
+    build(points);
+
+    VertexArray va(points.size() / 2);
+    va.addBuffer("v", 0, points);
+    return va;
+  }
+
+  // Rewrites the patches of a vertex array made by load() in place.
+  void load(VertexArray &va) {
+    build(scratch);
+    va.updateBuffer("v", scratch);
+    va.count = scratch.size() / 2;
+  }
+};
+
+#endif
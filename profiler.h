@@ -0,0 +1,222 @@
+// ==========================================================================
+// Frame profiler
+//
+// Scoped timers around the phases of a frame record CPU time, and GPU time
+// from GL_TIME_ELAPSED queries where asked for, into a fixed-size ring. The
+// ring never blocks the frame: the oldest samples are overwritten and a
+// reader copying them out drops any that were overwritten while it read.
+// Query results are collected a few frames late, once available, so the
+// profiler never waits on the GPU. Under RecordingBackend queries complete
+// at once with no time, so the same code runs headless.
+// ==========================================================================
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "glbackend.h"
+
+enum ProfilePhase { PHASE_LOAD, PHASE_LAYOUT, PHASE_UPLOAD, PHASE_DRAW, PHASE_SWAP, PHASE_COUNT };
+
+const char *const PHASE_NAMES[PHASE_COUNT] = { "load", "layout", "upload", "draw", "swap" };
+
+struct ProfileSample {
+  unsigned frame;
+  unsigned char phase;
+  bool gpu;
+  float ms;
+};
+
+// Single writer, any number of readers.
+class SampleRing {
+  std::vector<ProfileSample> samples;
+  size_t mask;
+  std::atomic<unsigned long> written;
+
+public:
+  // capacity is rounded up to a power of two.
+  explicit SampleRing(size_t capacity) : written(0) {
+    size_t size = 1;
+    while (size < capacity) size *= 2;
+    samples.resize(size);
+    mask = size - 1;
+  }
+
+  size_t capacity() const { return samples.size(); }
+
+  void push(const ProfileSample &sample) {
+    unsigned long n = written.load(std::memory_order_relaxed);
+    samples[n & mask] = sample;
+    written.store(n + 1, std::memory_order_release);
+  }
+
+  // Copies the samples in the ring, oldest first. out is cleared first and
+  // given room for a full ring, so a reused one is allocated once.
+  void snapshot(std::vector<ProfileSample> &out) const {
+    out.clear();
+    out.reserve(samples.size());
+    unsigned long end = written.load(std::memory_order_acquire);
+    unsigned long begin = end > samples.size() ? end - samples.size() : 0;
+    for (unsigned long i = begin; i < end; i++) out.push_back(samples[i & mask]);
+
+    // Drop what the writer overwrote in the meantime
+    unsigned long after = written.load(std::memory_order_acquire);
+    unsigned long valid = after > samples.size() ? after - samples.size() : 0;
+    if (valid > begin) out.erase(out.begin(), out.begin() + std::min<size_t>(valid - begin, out.size()));
+  }
+};
+
+class Profiler {
+  typedef std::chrono::steady_clock Clock;
+
+  struct Pending {
+    GLuint query;
+    unsigned frame;
+    ProfilePhase phase;
+  };
+
+  SampleRing ring;
+  bool gpu;
+  unsigned frame;
+  Clock::time_point starts[PHASE_COUNT];
+  GLuint active[PHASE_COUNT];
+  std::vector<GLuint> queries;       // free for reuse
+  std::vector<Pending> pending;      // oldest first
+  std::vector<ProfileSample> scratch;
+  std::vector<float> times;
+
+  // Turns the query results that are ready into samples. Queries finish in
+  // order, so the first one still running stops the scan.
+  void collect() {
+    GLBackend &gl = glBackend();
+    size_t done = 0;
+    for (; done < pending.size(); done++) {
+      const Pending &p = pending[done];
+      if (!gl.getQueryObjectiv(p.query, GL_QUERY_RESULT_AVAILABLE)) break;
+      ProfileSample sample = { p.frame, (unsigned char)p.phase, true,
+                               (float)(gl.getQueryObjectui64v(p.query, GL_QUERY_RESULT) * 1e-6) };
+      ring.push(sample);
+      queries.push_back(p.query);
+    }
+    pending.erase(pending.begin(), pending.begin() + done);
+  }
+
+public:
+  // gpuTimers needs a GL backend for the profiler's whole life.
+  explicit Profiler(bool gpuTimers = false, size_t capacity = 1 << 14)
+    : ring(capacity), gpu(gpuTimers), frame(0) {
+    std::fill(active, active + PHASE_COUNT, 0);
+  }
+
+  ~Profiler() {
+    if (!gpu) return;
+    GLBackend &gl = glBackend();
+    for (GLuint query : queries) gl.deleteQuery(query);
+    for (const Pending &p : pending) gl.deleteQuery(p.query);
+  }
+
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  unsigned frameNumber() const { return frame; }
+
+  void beginFrame() {
+    frame++;
+    if (gpu) collect();
+  }
+
+  // Starts timing phase. Only one GPU-timed phase may run at a time, so
+  // timed phases must not nest.
+  void begin(ProfilePhase phase, bool gpuTimed = false) {
+    if (gpu && gpuTimed) {
+      GLBackend &gl = glBackend();
+      GLuint query;
+      if (queries.empty()) {
+        query = gl.genQuery();
+      } else {
+        query = queries.back();
+        queries.pop_back();
+      }
+      gl.beginQuery(GL_TIME_ELAPSED, query);
+      active[phase] = query;
+    }
+    starts[phase] = Clock::now();
+  }
+
+  void end(ProfilePhase phase) {
+    float ms = std::chrono::duration<float, std::milli>(Clock::now() - starts[phase]).count();
+    ProfileSample sample = { frame, (unsigned char)phase, false, ms };
+    ring.push(sample);
+    if (active[phase]) {
+      glBackend().endQuery(GL_TIME_ELAPSED);
+      Pending p = { active[phase], frame, phase };
+      pending.push_back(p);
+      active[phase] = 0;
+    }
+  }
+
+  void snapshot(std::vector<ProfileSample> &out) const { ring.snapshot(out); }
+
+  // Median and 99th percentile of the phase's samples still in the ring, in
+  // ms. Returns false if there are none.
+  bool percentiles(ProfilePhase phase, bool gpuTime, float &p50, float &p99) {
+    ring.snapshot(scratch);
+    times.clear();
+    times.reserve(scratch.capacity());
+    for (const ProfileSample &s : scratch)
+      if (s.phase == phase && s.gpu == gpuTime) times.push_back(s.ms);
+    if (times.empty()) return false;
+    size_t median = times.size() / 2, high = std::min(times.size() - 1, times.size() * 99 / 100);
+    std::nth_element(times.begin(), times.begin() + median, times.end());
+    p50 = times[median];
+    std::nth_element(times.begin(), times.begin() + high, times.end());
+    p99 = times[high];
+    return true;
+  }
+
+  // Writes the samples in the ring as JSON if path ends in .json, else as
+  // CSV.
+  bool dump(const std::string &path) {
+    ring.snapshot(scratch);
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    bool json = path.size() > 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    if (json) {
+      fprintf(file, "{\n  \"samples\": [\n");
+      for (size_t i = 0; i < scratch.size(); i++) {
+        const ProfileSample &s = scratch[i];
+        fprintf(file, "    { \"frame\": %u, \"phase\": \"%s\", \"clock\": \"%s\", \"ms\": %.6f }%s\n",
+                s.frame, PHASE_NAMES[s.phase], s.gpu ? "gpu" : "cpu", s.ms, i + 1 < scratch.size() ? "," : "");
+      }
+      fprintf(file, "  ]\n}\n");
+    } else {
+      fprintf(file, "frame,phase,clock,ms\n");
+      for (const ProfileSample &s : scratch)
+        fprintf(file, "%u,%s,%s,%.6f\n", s.frame, PHASE_NAMES[s.phase], s.gpu ? "gpu" : "cpu", s.ms);
+    }
+    return fclose(file) == 0;
+  }
+};
+
+// Times the enclosing scope as one phase.
+class ScopedPhase {
+  Profiler &profiler;
+  ProfilePhase phase;
+
+public:
+  ScopedPhase(Profiler &p, ProfilePhase ph, bool gpuTimed = false) : profiler(p), phase(ph) {
+    profiler.begin(phase, gpuTimed);
+  }
+  ~ScopedPhase() { profiler.end(phase); }
+
+  ScopedPhase(const ScopedPhase &) = delete;
+  ScopedPhase &operator=(const ScopedPhase &) = delete;
+};
+
+#endif
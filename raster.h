@@ -0,0 +1,363 @@
+// ==========================================================================
+// Tile-based software rasterizer
+//
+// Renders the same layout-space patch stream Loader builds, with the same
+// zoom and pan as render(), into an RGBA image without a GPU. Patches are
+// projected to pixels and flattened to within a fraction of a pixel, the
+// resulting edges are binned into square tiles, and tiles are rasterized
+// in parallel on a ThreadPool.
+//
+// Outlines are drawn as anti-aliased hairlines. Filled glyphs use non-zero
+// winding with exact area coverage: each edge adds its signed coverage to
+// an accumulation buffer and a running sum along each row gives the
+// winding-weighted coverage of every pixel. Edges left of a tile still
+// count, collapsed onto its left border, so tiles are independent.
+// ==========================================================================
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bezier.h"
+#include "threadpool.h"
+
+struct Image {
+  int width;
+  int height;
+  std::vector<unsigned char> rgba;
+
+  Image(int w = 0, int h = 0) : width(w), height(h), rgba(w * h * 4) {}
+};
+
+inline bool writePPM(const Image &image, const std::string &path) {
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == NULL) return false;
+  fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+  for (int i = 0; i < image.width * image.height; i++) fwrite(&image.rgba[i * 4], 1, 3, file);
+  bool ok = ferror(file) == 0;
+  fclose(file);
+  return ok;
+}
+
+// Writes an RGBA PNG using uncompressed (stored) deflate blocks, which keeps
+// the writer free of a zlib dependency.
+inline bool writePNG(const Image &image, const std::string &path) {
+  struct Crc {
+    uint32_t table[256];
+    Crc() {
+      for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table[n] = c;
+      }
+    }
+    uint32_t operator()(const unsigned char *data, size_t size, uint32_t crc = 0) const {
+      crc = ~crc;
+      for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+      return ~crc;
+    }
+  };
+  static const Crc crc;
+
+  std::vector<unsigned char> raw;
+  size_t row = image.width * 4;
+  for (int y = 0; y < image.height; y++) {
+    raw.push_back(0);   // filter type: none
+    raw.insert(raw.end(), image.rgba.begin() + y * row, image.rgba.begin() + (y + 1) * row);
+  }
+
+  std::vector<unsigned char> zlib;
+  zlib.push_back(0x78);
+  zlib.push_back(0x01);
+  for (size_t pos = 0; pos < raw.size() || pos == 0; pos += 65535) {
+    size_t n = std::min<size_t>(65535, raw.size() - pos);
+    zlib.push_back(pos + n == raw.size() ? 1 : 0);
+    zlib.push_back(n & 0xff);
+    zlib.push_back(n >> 8);
+    zlib.push_back(~n & 0xff);
+    zlib.push_back((~n >> 8) & 0xff);
+    zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + n);
+    if (raw.empty()) break;
+  }
+  uint32_t a = 1, b = 0;
+  for (unsigned char c : raw) {
+    a = (a + c) % 65521;
+    b = (b + a) % 65521;
+  }
+  uint32_t adler = (b << 16) | a;
+  for (int shift = 24; shift >= 0; shift -= 8) zlib.push_back(adler >> shift);
+
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == NULL) return false;
+  auto chunk = [&](const char *type, const std::vector<unsigned char> &data) {
+    std::vector<unsigned char> body(type, type + 4);
+    body.insert(body.end(), data.begin(), data.end());
+    unsigned char length[4] = { (unsigned char)(data.size() >> 24), (unsigned char)(data.size() >> 16),
+                                (unsigned char)(data.size() >> 8), (unsigned char)data.size() };
+    uint32_t c = crc(body.data(), body.size());
+    unsigned char check[4] = { (unsigned char)(c >> 24), (unsigned char)(c >> 16),
+                               (unsigned char)(c >> 8), (unsigned char)c };
+    fwrite(length, 1, 4, file);
+    fwrite(body.data(), 1, body.size(), file);
+    fwrite(check, 1, 4, file);
+  };
+
+  static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  fwrite(signature, 1, 8, file);
+  std::vector<unsigned char> header = {
+    (unsigned char)(image.width >> 24), (unsigned char)(image.width >> 16),
+    (unsigned char)(image.width >> 8), (unsigned char)image.width,
+    (unsigned char)(image.height >> 24), (unsigned char)(image.height >> 16),
+    (unsigned char)(image.height >> 8), (unsigned char)image.height,
+    8, 6, 0, 0, 0   // 8-bit RGBA, no interlace
+  };
+  chunk("IHDR", header);
+  chunk("IDAT", zlib);
+  chunk("IEND", std::vector<unsigned char>());
+  bool ok = ferror(file) == 0;
+  fclose(file);
+  return ok;
+}
+
+// Straight edge in pixel coordinates, y down.
+struct RasterEdge {
+  float x0, y0, x1, y1;
+};
+
+class SoftwareRasterizer {
+  std::vector<std::vector<RasterEdge> > chunkEdges;
+  std::vector<RasterEdge> edges;
+  std::vector<std::vector<uint32_t> > bins;
+  Flattener flattener;
+
+  // Adds the signed area coverage of one edge to a w x h accumulation
+  // buffer. x is clamped to [0, w - 2].
+  static void accumulate(float *a, int w, int h, RasterEdge e) {
+    if (e.y0 == e.y1) return;
+    float dir = 1.0f;
+    if (e.y0 > e.y1) {
+      std::swap(e.x0, e.x1);
+      std::swap(e.y0, e.y1);
+      dir = -1.0f;
+    }
+    float dxdy = (e.x1 - e.x0) / (e.y1 - e.y0);
+    // Each row's x comes from the endpoints, not a running sum whose error
+    // could carry it out of the buffer, and is kept within it all the same
+    float xMin = std::max(std::min(e.x0, e.x1), 0.0f), xMax = std::min(std::max(e.x0, e.x1), (float)(w - 2));
+    auto xAt = [&](float y) { return std::min(std::max(e.x0 + (y - e.y0) * dxdy, xMin), xMax); };
+    int yEnd = std::min(h, (int)std::ceil(e.y1));
+    for (int y = std::max(0, (int)e.y0); y < yEnd; y++) {
+      float *line = a + y * w;
+      float top = std::max((float)y, e.y0), bottom = std::min((float)(y + 1), e.y1);
+      float dy = bottom - top;
+      float x = top == e.y0 ? e.x0 : xAt(top);
+      float xnext = bottom == e.y1 ? e.x1 : xAt(bottom);
+      x = std::min(std::max(x, 0.0f), (float)(w - 2));
+      xnext = std::min(std::max(xnext, 0.0f), (float)(w - 2));
+      float d = dy * dir;
+      float x0 = std::min(x, xnext), x1 = std::max(x, xnext);
+      float x0floor = std::floor(x0);
+      int x0i = (int)x0floor;
+      float x1ceil = std::ceil(x1);
+      int x1i = (int)x1ceil;
+      if (x1i <= x0i + 1) {
+        float xmf = 0.5f * (x + xnext) - x0floor;
+        line[x0i] += d - d * xmf;
+        line[x0i + 1] += d * xmf;
+      } else {
+        float s = 1.0f / (x1 - x0);
+        float x0f = x0 - x0floor;
+        float a0 = 0.5f * s * (1.0f - x0f) * (1.0f - x0f);
+        float x1f = x1 - x1ceil + 1.0f;
+        float am = 0.5f * s * x1f * x1f;
+        line[x0i] += d * a0;
+        if (x1i == x0i + 2) {
+          line[x0i + 1] += d * (1.0f - a0 - am);
+        } else {
+          float a1 = s * (1.5f - x0f);
+          line[x0i + 1] += d * (a1 - a0);
+          for (int xi = x0i + 2; xi < x1i - 1; xi++) line[xi] += d * s;
+          float a2 = a1 + (x1i - x0i - 3) * s;
+          line[x1i - 1] += d * (1.0f - a2 - am);
+        }
+        line[x1i] += d * am;
+      }
+    }
+  }
+
+  // Splits an edge (in tile coordinates) at the tile's left and right
+  // borders. Pieces left of the tile collapse onto x = 0, where they still
+  // carry their winding; pieces right of it cannot affect the tile.
+  static void accumulateClipped(float *a, int w, int h, int size, RasterEdge e) {
+    float t[4] = { 0.0f, 1.0f, 1.0f, 1.0f };
+    int n = 1;
+    float cuts[2] = { 0.0f, (float)size };
+    for (float cut : cuts) {
+      if ((e.x0 < cut) != (e.x1 < cut)) t[n++] = (cut - e.x0) / (e.x1 - e.x0);
+    }
+    if (n == 3 && t[1] > t[2]) std::swap(t[1], t[2]);
+    t[n] = 1.0f;
+    for (int i = 0; i < n; i++) {
+      RasterEdge p;
+      p.x0 = e.x0 + (e.x1 - e.x0) * t[i];
+      p.y0 = e.y0 + (e.y1 - e.y0) * t[i];
+      p.x1 = e.x0 + (e.x1 - e.x0) * t[i + 1];
+      p.y1 = e.y0 + (e.y1 - e.y0) * t[i + 1];
+      float mid = 0.5f * (p.x0 + p.x1);
+      if (mid >= size) continue;
+      if (mid <= 0.0f) p.x0 = p.x1 = 0.0f;
+      p.x0 = std::min(std::max(p.x0, 0.0f), (float)size);
+      p.x1 = std::min(std::max(p.x1, 0.0f), (float)size);
+      accumulate(a, w, h, p);
+    }
+  }
+
+  static float segmentDistance(float px, float py, const RasterEdge &e) {
+    float dx = e.x1 - e.x0, dy = e.y1 - e.y0;
+    float length2 = dx * dx + dy * dy;
+    float t = length2 > 0.0f ? ((px - e.x0) * dx + (py - e.y0) * dy) / length2 : 0.0f;
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    float ex = e.x0 + t * dx - px, ey = e.y0 + t * dy - py;
+    return std::sqrt(ex * ex + ey * ey);
+  }
+
+  void rasterizeTile(int tx, int ty, Image &image, std::vector<float> &coverage) const {
+    int x0 = tx * tileSize, y0 = ty * tileSize;
+    int w = std::min(tileSize, width - x0), h = std::min(tileSize, height - y0);
+    int stride = tileSize + 2;
+    coverage.assign(stride * tileSize, 0.0f);
+    const std::vector<uint32_t> &bin = bins[ty * tilesX() + tx];
+
+    if (fill) {
+      for (uint32_t i : bin) {
+        RasterEdge e = edges[i];
+        e.x0 -= x0; e.x1 -= x0;
+        e.y0 -= y0; e.y1 -= y0;
+        accumulateClipped(coverage.data(), stride, h, tileSize, e);
+      }
+      for (int y = 0; y < h; y++) {
+        float sum = 0.0f;
+        float *line = &coverage[y * stride];
+        for (int x = 0; x < w; x++) {
+          sum += line[x];
+          line[x] = std::min(1.0f, std::fabs(sum));
+        }
+      }
+    } else {
+      for (uint32_t i : bin) {
+        const RasterEdge &e = edges[i];
+        int left = std::max(x0, (int)std::floor(std::min(e.x0, e.x1) - 1.0f));
+        int right = std::min(x0 + w - 1, (int)std::ceil(std::max(e.x0, e.x1) + 1.0f));
+        int top = std::max(y0, (int)std::floor(std::min(e.y0, e.y1) - 1.0f));
+        int bottom = std::min(y0 + h - 1, (int)std::ceil(std::max(e.y0, e.y1) + 1.0f));
+        for (int y = top; y <= bottom; y++) {
+          for (int x = left; x <= right; x++) {
+            float c = 1.0f - segmentDistance(x + 0.5f, y + 0.5f, e);
+            float &pixel = coverage[(y - y0) * stride + (x - x0)];
+            if (c > pixel) pixel = c;
+          }
+        }
+      }
+    }
+
+    for (int y = 0; y < h; y++) {
+      unsigned char *out = &image.rgba[((y0 + y) * width + x0) * 4];
+      for (int x = 0; x < w; x++) {
+        float c = coverage[y * stride + x];
+        for (int k = 0; k < 4; k++) {
+          float v = background[k] + (foreground[k] - background[k]) * c;
+          out[x * 4 + k] = (unsigned char)(v * 255.0f + 0.5f);
+        }
+      }
+    }
+  }
+
+public:
+  int width;
+  int height;
+  int tileSize;
+  bool fill;               // non-zero winding fill instead of outlines
+  float tolerance;         // flattening tolerance in pixels
+  float foreground[4];
+  float background[4];
+
+  SoftwareRasterizer(int w, int h) : width(w), height(h), tileSize(64), fill(false), tolerance(0.25f) {
+    float fg[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    float bg[4] = { 0.2f, 0.2f, 0.2f, 1.0f };   // render()'s clear colour
+    std::copy(fg, fg + 4, foreground);
+    std::copy(bg, bg + 4, background);
+  }
+
+  int tilesX() const { return (width + tileSize - 1) / tileSize; }
+  int tilesY() const { return (height + tileSize - 1) / tileSize; }
+
+  // Renders patches with render()'s transform: clip x = scale * (x +
+  // translate) - 1, clip y = scale * y.
+  void render(const std::vector<float> &patches, float scale, float translate,
+              ThreadPool &pool, Image &image) {
+    image.width = width;
+    image.height = height;
+    image.rgba.resize(width * height * 4);
+
+    // Project and flatten, in chunks across the pool
+    size_t count = patches.size() / PATCH_FLOATS;
+    const size_t chunk = 256;
+    size_t chunks = (count + chunk - 1) / chunk;
+    chunkEdges.resize(chunks);
+    pool.parallelFor(chunks, [&](size_t c) {
+      std::vector<RasterEdge> &out = chunkEdges[c];
+      out.clear();
+      std::vector<float> points;
+      std::vector<int> counts;
+      for (size_t p = c * chunk; p < std::min(count, (c + 1) * chunk); p++) {
+        float projected[PATCH_FLOATS];
+        for (int i = 0; i < PATCH_FLOATS; i += 2) {
+          projected[i] = (scale * (patches[p * PATCH_FLOATS + i] + translate) * 0.5f) * width;
+          projected[i + 1] = (0.5f - scale * patches[p * PATCH_FLOATS + i + 1] * 0.5f) * height;
+        }
+        points.clear();
+        counts.clear();
+        flattener.flatten(projected, 1, tolerance, points, counts);
+        for (int i = 0; i + 1 < counts[0]; i++) {
+          RasterEdge e = { points[2 * i], points[2 * i + 1], points[2 * i + 2], points[2 * i + 3] };
+          out.push_back(e);
+        }
+      }
+    });
+    edges.clear();
+    for (const std::vector<RasterEdge> &c : chunkEdges) edges.insert(edges.end(), c.begin(), c.end());
+
+    // Bin edges into the tiles they touch; for fills, also every tile to the
+    // right in the same rows, which needs their winding.
+    int tx = tilesX(), ty = tilesY();
+    bins.resize(tx * ty);
+    for (std::vector<uint32_t> &bin : bins) bin.clear();
+    float pad = fill ? 0.0f : 1.0f;
+    for (size_t i = 0; i < edges.size(); i++) {
+      const RasterEdge &e = edges[i];
+      float top = std::min(e.y0, e.y1) - pad, bottom = std::max(e.y0, e.y1) + pad;
+      float left = std::min(e.x0, e.x1) - pad, right = std::max(e.x0, e.x1) + pad;
+      if (bottom < 0 || top >= height || (!fill && (right < 0 || left >= width))) continue;
+      if (left >= width) continue;
+      int row0 = std::max(0, (int)std::floor(top / tileSize));
+      int row1 = std::min(ty - 1, (int)std::floor(bottom / tileSize));
+      int col0 = std::max(0, (int)std::floor(left / tileSize));
+      int col1 = fill ? tx - 1 : std::min(tx - 1, (int)std::floor(right / tileSize));
+      for (int r = row0; r <= row1; r++)
+        for (int c = col0; c <= col1; c++) bins[r * tx + c].push_back(i);
+    }
+
+    pool.parallelFor(tx * ty, [&](size_t t) {
+      std::vector<float> coverage;
+      rasterizeTile(t % tx, t / tx, image, coverage);
+    });
+  }
+};
+
+#endif
@@ -0,0 +1,410 @@
+// ==========================================================================
+// Signed distance field glyph atlas
+//
+// Every glyph is rendered once into a small distance field computed straight
+// from its contours: the distance to each cubic is found by sampling and
+// refining with Newton's method, and the sign comes from the non-zero
+// winding of the outline. The fields are shelf-packed into one 8-bit atlas
+// with a metrics table, so text can be drawn at any zoom as textured quads
+// instead of re-tessellating the outlines.
+//
+// Generation is split across glyphs on a ThreadPool. The atlas is cached on
+// disk under a key hashed from the glyph outlines and the field parameters,
+// so it is only rebuilt when either changes, whichever font the outlines
+// were served from.
+// ==========================================================================
+
+#ifndef SDF_H
+#define SDF_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bezier.h"
+#include "glyphs.h"
+#include "layout.h"
+#include "threadpool.h"
+
+const uint32_t SDF_MAGIC = 0x31464453;   // "SDF1"
+const uint32_t SDF_VERSION = 1;
+
+// Where a glyph's field sits in the atlas and where it goes in glyph space.
+struct SDFGlyph {
+  int32_t code;
+  int32_t x, y;            // lower-left corner of the cell in the atlas, pixels
+  int32_t width, height;   // cell size in pixels; 0 for glyphs with no outline
+  float left, bottom;      // glyph-space position of the cell's lower-left corner
+};
+
+struct SDFHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  int32_t resolution;
+  int32_t spread;
+  int32_t width;
+  int32_t height;
+  int32_t glyphCount;
+  int32_t reserved;
+};
+
+// 8-bit distance field atlas. Rows run bottom to top, as GL textures do. A
+// texel of 128 lies on the outline; 255 and 0 are spread pixels or more
+// inside and outside it.
+class SDFAtlas {
+public:
+  int resolution;   // atlas pixels per glyph unit
+  int spread;       // distance in pixels covered by half the value range
+  int width;
+  int height;
+  std::vector<unsigned char> pixels;
+  std::vector<SDFGlyph> glyphs;   // sorted by code
+
+  SDFAtlas() : resolution(0), spread(0), width(0), height(0) {}
+
+  bool empty() const { return glyphs.empty(); }
+
+  const SDFGlyph *find(int code) const {
+    auto found = std::lower_bound(glyphs.begin(), glyphs.end(), code,
+                                  [](const SDFGlyph &g, int c) { return g.code < c; });
+    return found != glyphs.end() && found->code == code ? &*found : 0;
+  }
+
+  bool save(const std::string &path, uint64_t key) const {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL) return false;
+    SDFHeader header = { SDF_MAGIC, SDF_VERSION, key, resolution, spread, width, height,
+                         (int32_t)glyphs.size(), 0 };
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(glyphs.data(), sizeof(SDFGlyph), glyphs.size(), file);
+    fwrite(pixels.data(), 1, pixels.size(), file);
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+  }
+
+  // Loads a cached atlas. Fails if the file is missing, damaged or was built
+  // under a different key. The sizes in the header must account for the
+  // file exactly before anything is allocated from them.
+  bool load(const std::string &path, uint64_t key) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL) return false;
+    long fileSize = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    rewind(file);
+    SDFHeader header;
+    bool ok = fileSize >= (long)sizeof(header) && fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == SDF_MAGIC && header.version == SDF_VERSION && header.key == key &&
+              header.glyphCount >= 0 && header.width >= 0 && header.height >= 0;
+    ok = ok && (uint64_t)fileSize - sizeof(header) ==
+                   (uint64_t)header.glyphCount * sizeof(SDFGlyph) + (uint64_t)header.width * header.height;
+    if (ok) {
+      glyphs.resize(header.glyphCount);
+      pixels.resize((size_t)header.width * header.height);
+      ok = fread(glyphs.data(), sizeof(SDFGlyph), glyphs.size(), file) == glyphs.size() &&
+           fread(pixels.data(), 1, pixels.size(), file) == pixels.size();
+    }
+    fclose(file);
+    if (!ok) {
+      glyphs.clear();
+      pixels.clear();
+      return false;
+    }
+    resolution = header.resolution;
+    spread = header.spread;
+    width = header.width;
+    height = header.height;
+    return true;
+  }
+};
+
+// FNV-1a over the code point, commands and coordinates of every glyph
+// glyphs serves. Waits for any preload, so no glyph is skipped.
+inline uint64_t hashGlyphOutlines(GlyphCache &glyphs) {
+  glyphs.waitForPreload();
+  uint64_t hash = 14695981039346656037ULL;
+  auto mix = [&hash](const void *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      hash ^= ((const unsigned char *)data)[i];
+      hash *= 1099511628211ULL;
+    }
+  };
+  for (int code : glyphs.codePoints()) {
+    OutlineView outline = glyphs.get(code);
+    uint32_t counts[3] = { (uint32_t)code, (uint32_t)outline.commandCount, (uint32_t)outline.coordCount };
+    mix(counts, sizeof(counts));
+    mix(outline.commands, outline.commandCount);
+    mix(outline.coords, outline.coordCount * sizeof(float));
+  }
+  return hash;
+}
+
+inline uint64_t sdfCacheKey(uint64_t fontHash, int resolution, int spread) {
+  uint64_t key = fontHash;
+  int32_t parameters[3] = { (int32_t)SDF_VERSION, resolution, spread };
+  for (int32_t p : parameters) {
+    key ^= (uint32_t)p;
+    key *= 1099511628211ULL;
+  }
+  return key;
+}
+
+// One contour segment of a glyph: a cubic, or a line with only p[0..1] and
+// p[6..7] used.
+struct SDFSegment {
+  float p[8];
+  bool line;
+  float bbox[4];
+};
+
+// Outline segments and their flattened edges, in glyph space.
+inline void sdfSegments(const OutlineView &outline, float tolerance,
+                        std::vector<SDFSegment> &segments, std::vector<float> &edges) {
+  const float *c = outline.coords;
+  float start[2] = {}, pen[2] = {};
+  for (size_t i = 0; i < outline.commandCount; i++) {
+    SDFSegment s;
+    char command = outline.commands[i];
+    if (command == 'M') {
+      pen[0] = start[0] = c[0];
+      pen[1] = start[1] = c[1];
+      c += 2;
+      continue;
+    } else if (command == 'C') {
+      float p[8] = { pen[0], pen[1], c[0], c[1], c[2], c[3], c[4], c[5] };
+      std::copy(p, p + 8, s.p);
+      s.line = false;
+      c += 6;
+    } else {
+      const float *to = command == 'Z' ? start : c;
+      float p[8] = { pen[0], pen[1], 0, 0, 0, 0, to[0], to[1] };
+      std::copy(p, p + 8, s.p);
+      s.line = true;
+      if (command == 'L') c += 2;
+    }
+    pen[0] = s.p[6];
+    pen[1] = s.p[7];
+
+    s.bbox[0] = std::min(s.p[0], s.p[6]);
+    s.bbox[1] = std::min(s.p[1], s.p[7]);
+    s.bbox[2] = std::max(s.p[0], s.p[6]);
+    s.bbox[3] = std::max(s.p[1], s.p[7]);
+    if (s.line) {
+      edges.insert(edges.end(), { s.p[0], s.p[1], s.p[6], s.p[7] });
+    } else {
+      for (int k = 2; k <= 4; k += 2) {
+        s.bbox[0] = std::min(s.bbox[0], s.p[k]);
+        s.bbox[1] = std::min(s.bbox[1], s.p[k + 1]);
+        s.bbox[2] = std::max(s.bbox[2], s.p[k]);
+        s.bbox[3] = std::max(s.bbox[3], s.p[k + 1]);
+      }
+      int n = flattenSegments(s.p, tolerance, 64);
+      float x0 = s.p[0], y0 = s.p[1];
+      for (int k = 1; k <= n; k++) {
+        float x1, y1;
+        bezierPoint(s.p, (float)k / n, x1, y1);
+        edges.insert(edges.end(), { x0, y0, x1, y1 });
+        x0 = x1;
+        y0 = y1;
+      }
+    }
+    segments.push_back(s);
+  }
+}
+
+// Squared distance from (x, y) to a segment. Cubics start from the nearest
+// of a few samples and are refined with Newton's method on the derivative
+// of the squared distance.
+inline float sdfDistance2(const SDFSegment &s, float x, float y) {
+  const float *p = s.p;
+  if (s.line) {
+    float dx = p[6] - p[0], dy = p[7] - p[1];
+    float length2 = dx * dx + dy * dy;
+    float t = length2 > 0.0f ? ((x - p[0]) * dx + (y - p[1]) * dy) / length2 : 0.0f;
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    float ex = p[0] + t * dx - x, ey = p[1] + t * dy - y;
+    return ex * ex + ey * ey;
+  }
+
+  const int samples = 8;
+  float best = 1e30f, bestT = 0.0f;
+  for (int i = 0; i <= samples; i++) {
+    float t = (float)i / samples, bx, by;
+    bezierPoint(p, t, bx, by);
+    float d = (bx - x) * (bx - x) + (by - y) * (by - y);
+    if (d < best) {
+      best = d;
+      bestT = t;
+    }
+  }
+
+  float t = bestT;
+  for (int iteration = 0; iteration < 4; iteration++) {
+    float u = 1.0f - t;
+    float bx, by;
+    bezierPoint(p, t, bx, by);
+    float d1x = 3.0f * (u * u * (p[2] - p[0]) + 2.0f * t * u * (p[4] - p[2]) + t * t * (p[6] - p[4]));
+    float d1y = 3.0f * (u * u * (p[3] - p[1]) + 2.0f * t * u * (p[5] - p[3]) + t * t * (p[7] - p[5]));
+    float d2x = 6.0f * (u * (p[4] - 2.0f * p[2] + p[0]) + t * (p[6] - 2.0f * p[4] + p[2]));
+    float d2y = 6.0f * (u * (p[5] - 2.0f * p[3] + p[1]) + t * (p[7] - 2.0f * p[5] + p[3]));
+    float ex = bx - x, ey = by - y;
+    float f = ex * d1x + ey * d1y;
+    float fp = d1x * d1x + d1y * d1y + ex * d2x + ey * d2y;
+    if (fp <= 0.0f) break;
+    t = std::min(std::max(t - f / fp, 0.0f), 1.0f);
+  }
+  float bx, by;
+  bezierPoint(p, t, bx, by);
+  return std::min(best, (bx - x) * (bx - x) + (by - y) * (by - y));
+}
+
+// Computes the field of one glyph into its cell of atlas.
+inline void renderSDFGlyph(const OutlineView &outline, const SDFGlyph &glyph,
+                           int resolution, int spread, SDFAtlas &atlas) {
+  if (glyph.width == 0) return;
+  float pixel = 1.0f / resolution;
+  float range = spread * pixel;
+
+  std::vector<SDFSegment> segments;
+  std::vector<float> edges;
+  sdfSegments(outline, 0.1f * pixel, segments, edges);
+
+  std::vector<std::pair<float, int> > crossings;
+  for (int row = 0; row < glyph.height; row++) {
+    float y = glyph.bottom + (row + 0.5f) * pixel;
+
+    // Winding at each pixel: crossings of a ray from the pixel to -x
+    crossings.clear();
+    for (size_t e = 0; e < edges.size(); e += 4) {
+      float y0 = edges[e + 1], y1 = edges[e + 3];
+      if ((y0 <= y) == (y1 <= y)) continue;
+      float x = edges[e] + (y - y0) / (y1 - y0) * (edges[e + 2] - edges[e]);
+      crossings.push_back(std::make_pair(x, y1 > y0 ? 1 : -1));
+    }
+    std::sort(crossings.begin(), crossings.end());
+    size_t next = 0;
+    int winding = 0;
+
+    unsigned char *out = &atlas.pixels[(size_t)(glyph.y + row) * atlas.width + glyph.x];
+    for (int column = 0; column < glyph.width; column++) {
+      float x = glyph.left + (column + 0.5f) * pixel;
+      for (; next < crossings.size() && crossings[next].first < x; next++) winding += crossings[next].second;
+
+      float best = range * range;
+      for (const SDFSegment &s : segments) {
+        float dx = std::max(std::max(s.bbox[0] - x, x - s.bbox[2]), 0.0f);
+        float dy = std::max(std::max(s.bbox[1] - y, y - s.bbox[3]), 0.0f);
+        if (dx * dx + dy * dy >= best) continue;
+        best = std::min(best, sdfDistance2(s, x, y));
+      }
+      float distance = std::sqrt(best) / range;
+      if (winding == 0) distance = -distance;
+      float value = std::min(std::max(0.5f + 0.5f * distance, 0.0f), 1.0f);
+      out[column] = (unsigned char)(value * 255.0f + 0.5f);
+    }
+  }
+}
+
+// Builds the atlas for codes. Outlines are fetched from glyphs up front, so
+// only the field computation runs on the pool.
+inline void buildSDFAtlas(GlyphCache &glyphs, std::vector<int> codes, int resolution, int spread,
+                          ThreadPool &pool, SDFAtlas &atlas) {
+  std::sort(codes.begin(), codes.end());
+  codes.erase(std::unique(codes.begin(), codes.end()), codes.end());
+
+  atlas.resolution = resolution;
+  atlas.spread = spread;
+  atlas.glyphs.assign(codes.size(), SDFGlyph());
+  std::vector<OutlineView> outlines(codes.size());
+
+  // Cell sizes from the control point bounds, padded by the spread
+  size_t area = 0;
+  for (size_t i = 0; i < codes.size(); i++) {
+    SDFGlyph &g = atlas.glyphs[i];
+    g.code = codes[i];
+    outlines[i] = glyphs.get(codes[i]);
+    const OutlineView &o = outlines[i];
+    if (o.coordCount < 2) continue;
+    float bbox[4] = { o.coords[0], o.coords[1], o.coords[0], o.coords[1] };
+    for (size_t k = 0; k + 1 < o.coordCount; k += 2) {
+      bbox[0] = std::min(bbox[0], o.coords[k]);
+      bbox[1] = std::min(bbox[1], o.coords[k + 1]);
+      bbox[2] = std::max(bbox[2], o.coords[k]);
+      bbox[3] = std::max(bbox[3], o.coords[k + 1]);
+    }
+    float x0 = std::floor(bbox[0] * resolution) - spread, y0 = std::floor(bbox[1] * resolution) - spread;
+    float x1 = std::ceil(bbox[2] * resolution) + spread, y1 = std::ceil(bbox[3] * resolution) + spread;
+    g.left = x0 / resolution;
+    g.bottom = y0 / resolution;
+    g.width = (int)(x1 - x0);
+    g.height = (int)(y1 - y0);
+    area += (size_t)g.width * g.height;
+  }
+
+  // Shelf packing, tallest cells first, into a power-of-two wide atlas
+  atlas.width = 256;
+  while ((size_t)atlas.width * atlas.width < area + area / 8) atlas.width *= 2;
+  std::vector<size_t> order(codes.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&atlas](size_t a, size_t b) {
+    return atlas.glyphs[a].height > atlas.glyphs[b].height;
+  });
+  int x = 0, y = 0, shelf = 0;
+  for (size_t i : order) {
+    SDFGlyph &g = atlas.glyphs[i];
+    if (g.width == 0) continue;
+    if (x + g.width > atlas.width) {
+      x = 0;
+      y += shelf;
+      shelf = 0;
+    }
+    g.x = x;
+    g.y = y;
+    x += g.width;
+    shelf = std::max(shelf, g.height);
+  }
+  atlas.height = y + shelf;
+  atlas.pixels.assign((size_t)atlas.width * atlas.height, 0);
+
+  // Cells are disjoint, so glyphs are written without locking
+  pool.parallelFor(codes.size(), [&](size_t i) {
+    renderSDFGlyph(outlines[i], atlas.glyphs[i], resolution, spread, atlas);
+  });
+}
+
+// Two triangles per glyph covering its cell, for drawing with
+// sdfVertex.glsl: layout-space positions and atlas texture coordinates.
+// Glyphs the atlas lacks are skipped.
+inline void buildSDFQuads(const SDFAtlas &atlas, const TextLayout &layout,
+                          std::vector<float> &positions, std::vector<float> &texCoords) {
+  positions.clear();
+  texCoords.clear();
+  for (const GlyphPlacement &placement : layout.glyphs) {
+    const SDFGlyph *g = atlas.find(placement.code);
+    if (g == 0 || g->width == 0) continue;
+    float x0 = placement.x + g->left, y0 = placement.y + g->bottom;
+    float x1 = x0 + (float)g->width / atlas.resolution, y1 = y0 + (float)g->height / atlas.resolution;
+    float u0 = (float)g->x / atlas.width, v0 = (float)g->y / atlas.height;
+    float u1 = (float)(g->x + g->width) / atlas.width, v1 = (float)(g->y + g->height) / atlas.height;
+    positions.insert(positions.end(), { x0, y0, x1, y0, x1, y1, x0, y0, x1, y1, x0, y1 });
+    texCoords.insert(texCoords.end(), { u0, v0, u1, v0, u1, v1, u0, v0, u1, v1, u0, v1 });
+  }
+}
+
+// Loads the atlas for every glyph glyphs serves from cachePath, or builds and
+// caches it if the cache is missing or stale. Returns true on a cache hit.
+inline bool loadOrBuildSDFAtlas(GlyphCache &glyphs, int resolution, int spread,
+                                const std::string &cachePath, ThreadPool &pool, SDFAtlas &atlas) {
+  uint64_t key = sdfCacheKey(hashGlyphOutlines(glyphs), resolution, spread);
+  if (atlas.load(cachePath, key)) return true;
+
+  buildSDFAtlas(glyphs, glyphs.codePoints(), resolution, spread, pool, atlas);
+  if (!atlas.save(cachePath, key))
+    std::cerr << "Impossible to write the file, " << cachePath << std::endl;
+  return false;
+}
+
+#endif
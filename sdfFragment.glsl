@@ -0,0 +1,16 @@
+#version 410
+
+in vec2 uv;
+
+// Distance field atlas: 0.5 on the outline, increasing inwards
+uniform sampler2D field;
+
+out vec4 FragmentColour;
+
+void main() {
+  float d = texture(field, uv).r;
+
+  // Antialias over about one pixel whatever the zoom
+  float w = max(0.7 * fwidth(d), 1e-4);
+  FragmentColour = vec4(1, 1, 1, smoothstep(0.5 - w, 0.5 + w, d));
+}
@@ -0,0 +1,14 @@
+#version 410
+
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 texCoord;
+
+uniform mat4x4 S;
+uniform mat4x4 T;
+
+out vec2 uv;
+
+void main() {
+  uv = texCoord;
+  gl_Position = S * T * vec4(position, 0.0, 1.0);
+}
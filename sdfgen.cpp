@@ -0,0 +1,115 @@
+// ==========================================================================
+// sdfgen: builds the signed distance field atlas for a glyph directory
+//
+// Usage:  sdfgen [-r resolution] [-s spread] [-threads N] [-png atlas.png]
+//                [directory] [output]      (defaults: 48 4 cmuntt/ cmuntt.sdf)
+//         sdfgen -bench [-r resolution] [-s spread] [directory]
+//
+// The atlas is only rebuilt when the cached one in output is stale. -bench
+// always rebuilds it and reports the generation time per thread count.
+// ==========================================================================
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "raster.h"
+#include "sdf.h"
+#include "threadpool.h"
+
+using std::string;
+using std::vector;
+using std::cerr;
+using std::endl;
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void benchThreads(const string &directory, int resolution, int spread) {
+  GlyphCache glyphs(directory, "");
+  vector<int> codes = listGlyphCodes(directory);
+  for (int code : codes) glyphs.get(code);
+
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  vector<unsigned> counts;
+  for (unsigned t = 1; t < cores; t *= 2) counts.push_back(t);
+  counts.push_back(cores);
+
+  printf("sdfgen: %zu glyphs at %d px per unit, spread %d px, %u cores\n",
+         codes.size(), resolution, spread, cores);
+  double single = 0.0;
+  for (unsigned threads : counts) {
+    ThreadPool pool(threads);
+    SDFAtlas atlas;
+    Clock::time_point start = Clock::now();
+    buildSDFAtlas(glyphs, codes, resolution, spread, pool, atlas);
+    double seconds = secondsSince(start);
+    if (threads == 1) single = seconds;
+    printf("  %2u threads  %8.1f ms  %5.2fx  (%dx%d atlas)\n", threads, seconds * 1e3,
+           single / seconds, atlas.width, atlas.height);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  string directory = "cmuntt/", output = "cmuntt.sdf", png;
+  int resolution = 48, spread = 4;
+  unsigned threads = 0;
+  bool bench = false;
+  vector<string> positional;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-bench") bench = true;
+    else if (arg == "-r" && i + 1 < argc) resolution = atoi(argv[++i]);
+    else if (arg == "-s" && i + 1 < argc) spread = atoi(argv[++i]);
+    else if (arg == "-threads" && i + 1 < argc) threads = atoi(argv[++i]);
+    else if (arg == "-png" && i + 1 < argc) png = argv[++i];
+    else positional.push_back(arg);
+  }
+  if (positional.size() > 0) directory = positional[0];
+  if (positional.size() > 1) output = positional[1];
+  if (directory.back() != '/') directory += '/';
+
+  if (resolution <= 0 || spread <= 0) {
+    cerr << "Resolution and spread must be positive" << endl;
+    return 1;
+  }
+
+  if (bench) {
+    benchThreads(directory, resolution, spread);
+    return 0;
+  }
+
+  ThreadPool pool(threads);
+  SDFAtlas atlas;
+  Clock::time_point start = Clock::now();
+  GlyphCache glyphs(directory, "");
+  bool cached = loadOrBuildSDFAtlas(glyphs, resolution, spread, output, pool, atlas);
+  printf("%s %s: %zu glyphs, %dx%d atlas in %.1f ms\n", cached ? "Loaded" : "Built",
+         output.c_str(), atlas.glyphs.size(), atlas.width, atlas.height, secondsSince(start) * 1e3);
+
+  if (!png.empty()) {
+    Image image(atlas.width, atlas.height);
+    for (int y = 0; y < atlas.height; y++) {
+      for (int x = 0; x < atlas.width; x++) {
+        unsigned char v = atlas.pixels[(size_t)(atlas.height - 1 - y) * atlas.width + x];
+        unsigned char *out = &image.rgba[((size_t)y * atlas.width + x) * 4];
+        out[0] = out[1] = out[2] = v;
+        out[3] = 255;
+      }
+    }
+    if (!writePNG(image, png)) {
+      cerr << "Impossible to write the file, " << png << endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -1,9 +1,52 @@
 #version 410
 
 layout (vertices = 4) out;
+
+uniform vec2 viewport;       // framebuffer size in pixels
+uniform float tolerance;     // allowed distance from the true curve, in pixels
+uniform float maxLevel;      // quality setting: most segments a patch may get
+
+in vec4 colour[];
+patch out vec4 patchColour;  // one per patch: every vertex has its glyph's
+
+// Segments needed to keep the patch within tolerance on screen; mirrors
+// screenSegments() in bezier.h. A cubic strays at most 3/4 of its control
+// polygon's distance d from the chord, and n uniform segments cut that by
+// about n^2, so straight segments get a single line.
+float segments(vec2 p0, vec2 p1, vec2 p2, vec2 p3)
+{
+   vec2 chord = p3 - p0;
+   float len = length(chord);
+   float d1, d2;
+   if (len > 1e-6) {
+      d1 = abs(chord.x * (p1.y - p0.y) - chord.y * (p1.x - p0.x)) / len;
+      d2 = abs(chord.x * (p2.y - p0.y) - chord.y * (p2.x - p0.x)) / len;
+   } else {
+      d1 = distance(p1, p0);
+      d2 = distance(p2, p0);
+   }
+   float n = ceil(sqrt(0.75 * max(d1, d2) / tolerance));
+   return clamp(n, 1.0, maxLevel);
+}
+
+// Control point i of the cubic. Lines arrive as 2-vertex patches and become
+// the cubic with its inner points at 1/3 and 2/3, the same straight segment.
+vec4 control(int i)
+{
+   if (gl_PatchVerticesIn == 4) return gl_in[i].gl_Position;
+   return mix(gl_in[0].gl_Position, gl_in[1].gl_Position, float(i) / 3.0);
+}
+
 void main()
 {
-   gl_TessLevelOuter[0] = 1;
-   gl_TessLevelOuter[1] = 16;
-   gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
+   if (gl_InvocationID == 0) {
+      patchColour = colour[0];
+      vec2 toPixels = 0.5 * viewport;
+      gl_TessLevelOuter[0] = 1;
+      gl_TessLevelOuter[1] = segments(control(0).xy * toPixels,
+                                      control(1).xy * toPixels,
+                                      control(2).xy * toPixels,
+                                      control(3).xy * toPixels);
+   }
+   gl_out[gl_InvocationID].gl_Position = control(gl_InvocationID);
 }
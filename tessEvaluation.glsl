@@ -1,6 +1,9 @@
 #version 410
 
 layout (isolines, equal_spacing, ccw) in;
+
+patch in vec4 patchColour;
+out vec4 colour;
                                       
 ///////////////////////////////////////////////////
 // function to evaluate a Bezier curve from 4 control points using the
@@ -29,5 +32,6 @@ void main()
   vec3 vResult = bezier( u, v0, v1, v2, v3 ); 
   vec4 pos = vec4( vResult, 1.);
   gl_Position = pos;
+  colour = patchColour;
 }
 
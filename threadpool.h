@@ -0,0 +1,127 @@
+// ==========================================================================
+// Work-stealing thread pool
+//
+// Each worker owns a deque of tasks. A worker pops from the back of its own
+// deque and, when that is empty, steals from the front of the others, so
+// uneven work (a busy tile, a complex glyph) spreads across cores. The
+// thread calling parallelFor() works and steals too until the batch is done.
+// ==========================================================================
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()> > tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue> > queues;   // one per worker, plus the caller's
+  std::vector<std::thread> workers;
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  std::atomic<size_t> queued;
+  std::atomic<size_t> next;
+  std::atomic<bool> stopping;
+
+  bool popOrSteal(size_t self, std::function<void()> &task) {
+    {
+      Queue &own = *queues[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+      Queue &other = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(other.mutex);
+      if (!other.tasks.empty()) {
+        task = std::move(other.tasks.front());
+        other.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool runOne(size_t self) {
+    std::function<void()> task;
+    if (!popOrSteal(self, task)) return false;
+    queued--;
+    task();
+    return true;
+  }
+
+  void work(size_t self) {
+    while (!stopping) {
+      if (runOne(self)) continue;
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait(lock, [this] { return stopping || queued > 0; });
+    }
+  }
+
+public:
+  // threads is the total including the calling thread; 0 means one per core.
+  explicit ThreadPool(unsigned threads = 0) : queued(0), next(0), stopping(false) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < threads; i++) queues.push_back(std::unique_ptr<Queue>(new Queue));
+    for (unsigned i = 1; i < threads; i++) workers.push_back(std::thread(&ThreadPool::work, this, i));
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers) worker.join();
+  }
+
+  unsigned size() const { return queues.size(); }
+
+  // Queues a task without waiting for it. Tasks are dealt round-robin.
+  void submit(std::function<void()> task) {
+    Queue &queue = *queues[next++ % queues.size()];
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      queued++;
+    }
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+  }
+
+  // Calls f(i) for every i in [0, count) across the pool and returns once all
+  // calls have finished.
+  template <typename F>
+  void parallelFor(size_t count, F f) {
+    std::atomic<size_t> remaining(count);
+    for (size_t i = 0; i < count; i++) {
+      submit([&f, &remaining, i] {
+        f(i);
+        remaining--;
+      });
+    }
+    while (remaining > 0) {
+      if (!runOne(0)) std::this_thread::yield();
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,65 @@
+// ==========================================================================
+// UTF-8 decoding
+//
+// Text arrives as UTF-8 (argv, files). Malformed input never stops
+// decoding: each bad byte, overlong form, surrogate or out-of-range value
+// becomes one U+FFFD.
+// ==========================================================================
+
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <string>
+#include <vector>
+
+const int REPLACEMENT_CHARACTER = 0xFFFD;
+
+// Decodes the code point starting at p and advances p past it.
+inline int nextCodePoint(const char *&p, const char *end) {
+  unsigned char c = *p++;
+  if (c < 0x80) return c;
+
+  int extra, code, min;
+  if ((c & 0xE0) == 0xC0) { extra = 1; code = c & 0x1F; min = 0x80; }
+  else if ((c & 0xF0) == 0xE0) { extra = 2; code = c & 0x0F; min = 0x800; }
+  else if ((c & 0xF8) == 0xF0) { extra = 3; code = c & 0x07; min = 0x10000; }
+  else return REPLACEMENT_CHARACTER;
+
+  const char *q = p;
+  for (int i = 0; i < extra; i++, q++) {
+    if (q == end || ((unsigned char)*q & 0xC0) != 0x80) return REPLACEMENT_CHARACTER;
+    code = (code << 6) | ((unsigned char)*q & 0x3F);
+  }
+  if (code < min || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) return REPLACEMENT_CHARACTER;
+  p = q;
+  return code;
+}
+
+// Decodes text into code points. codes is cleared first; its capacity is
+// reused.
+inline void decodeUTF8(const std::string &text, std::vector<int> &codes) {
+  codes.clear();
+  codes.reserve(text.size());
+  const char *p = text.data(), *end = p + text.size();
+  while (p < end) codes.push_back(nextCodePoint(p, end));
+}
+
+inline void appendUTF8(int code, std::string &out) {
+  if (code < 0x80) {
+    out += (char)code;
+  } else if (code < 0x800) {
+    out += (char)(0xC0 | (code >> 6));
+    out += (char)(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    out += (char)(0xE0 | (code >> 12));
+    out += (char)(0x80 | ((code >> 6) & 0x3F));
+    out += (char)(0x80 | (code & 0x3F));
+  } else {
+    out += (char)(0xF0 | (code >> 18));
+    out += (char)(0x80 | ((code >> 12) & 0x3F));
+    out += (char)(0x80 | ((code >> 6) & 0x3F));
+    out += (char)(0x80 | (code & 0x3F));
+  }
+}
+
+#endif
@@ -1,10 +1,14 @@
 #version 410
 
-layout(location = 0) in vec2 position;
+layout(location = 0) in vec2 position;   // glyph space, in 16-bit steps
+layout(location = 1) in vec3 instance;   // pen x, pen y, scale per step
 
 uniform mat4x4 S;
 uniform mat4x4 T;
 
+out vec4 colour;
+
 void main() {
-  gl_Position = vec4(position, 0.0, 1.0);
+  gl_Position = S * T * vec4(position * instance.z + instance.xy, 0.0, 1.0);
+  colour = vec4(1, 1, 1, 1);
 }